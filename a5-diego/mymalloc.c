@@ -1,45 +1,191 @@
 #define _DEFAULT_SOURCE
-#define _BSD_SOURCE 
+#define _BSD_SOURCE
 #include <unistd.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <debug.h>
 
 typedef struct block {
-    size_t size;        
-    struct block *next; 
-    int free;          
+    size_t size;
+    struct block *next;
+    struct block *prev;
+    int free;
 } block_t;
 
 #define BLOCK_SIZE sizeof(block_t)
 
-block_t *free_list = NULL; 
+/*
+ * The heap grows the break by at least HEAP_CHUNK bytes at a time, or by as
+ * much as it already holds up to HEAP_CHUNK_MAX, so a growing heap takes a
+ * few steps of doubling size. The new memory is split into the requested
+ * block and a free rest. Freed
+ * blocks merge with free neighbours, and once the free block at the top of
+ * the heap reaches the trim threshold, all but HEAP_CHUNK of it goes back
+ * to the system with a negative sbrk. A program that keeps growing the heap
+ * right after a trim doubles the threshold (up to TRIM_THRESHOLD_MAX), so a
+ * loop that allocates and frees a large block does not move the break back
+ * and forth every time.
+ */
+#define ALIGNMENT 16
+#define HEAP_CHUNK (128 * 1024)
+#define HEAP_CHUNK_MAX (4 * 1024 * 1024)
+#define TRIM_THRESHOLD (256 * 1024)
+#define TRIM_THRESHOLD_MAX (64 * 1024 * 1024)
+
+block_t *free_list = NULL;      // every block, in address order
+static block_t *heap_top = NULL; // last block of the list
+static size_t trim_threshold = TRIM_THRESHOLD;
+static int trimmed = 0;          // the last change of the break was a trim
+
+/*
+ * The break as the allocator last left it, and the bytes it added since.
+ * Nothing else must move the break down. Something moving it up is noticed
+ * at the next growth, as sbrk returns the old break; a trim assumes that
+ * nothing did since the last growth.
+ */
+static char *heap_end = NULL;
+static size_t heap_bytes = 0;
+
+/*
+ * Address just past the payload of block
+ */
+static char *block_end(block_t *block) {
+    return (char *)(block + 1) + block->size;
+}
+
+/*
+ * Blocks are adjacent unless someone else moved the break in between
+ */
+static int adjacent(block_t *block, block_t *next) {
+    return next && block_end(block) == (char *)next;
+}
+
+/*
+ * Give the top of the heap back if it is free, large enough and still
+ * ends at the break.
+ */
+static void trim_top(void) {
+    block_t *top = heap_top;
+    if (!top || !top->free || top->size < trim_threshold ||
+        block_end(top) != heap_end)
+        return;
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t release = (top->size - HEAP_CHUNK) & ~(page - 1);
+    debug_printf("Trim %zu\n", release);
+    sbrk(-(intptr_t)release);
+    top->size -= release;
+    heap_end -= release;
+    heap_bytes -= release;
+    trimmed = 1;
+}
+
+/*
+ * Merge block with the next block if both are free and adjacent
+ */
+static void merge_next(block_t *block) {
+    block_t *next = block->next;
+    if (!block->free || !next || !next->free || !adjacent(block, next))
+        return;
+    block->size += BLOCK_SIZE + next->size;
+    block->next = next->next;
+    if (next->next)
+        next->next->prev = block;
+    else
+        heap_top = block;
+}
+
+/*
+ * Cut block down to s bytes if the rest can hold another block
+ */
+static void split(block_t *block, size_t s) {
+    if (block->size < s + BLOCK_SIZE + ALIGNMENT)
+        return;
+    block_t *rest = (block_t *)((char *)(block + 1) + s);
+    rest->size = block->size - s - BLOCK_SIZE;
+    rest->free = 1;
+    rest->prev = block;
+    rest->next = block->next;
+    if (block->next)
+        block->next->prev = rest;
+    else
+        heap_top = rest;
+    block->next = rest;
+    block->size = s;
+    merge_next(rest);
+}
+
+/*
+ * Grow the heap so that its top block is free and holds at least s bytes.
+ */
+static block_t *grow_heap(size_t s) {
+    block_t *top = heap_top;
+    int extend = top && top->free && block_end(top) == heap_end;
+
+    // Keep blocks aligned even if the break is not; the first time the break
+    // is unknown, so leave room for the largest padding
+    size_t pad = heap_end ? (ALIGNMENT - (uintptr_t)heap_end % ALIGNMENT) % ALIGNMENT
+                          : ALIGNMENT - 1;
+    size_t need = extend ? s - top->size : pad + BLOCK_SIZE + s;
+    size_t chunk = heap_bytes < HEAP_CHUNK_MAX ? heap_bytes : HEAP_CHUNK_MAX;
+    if (chunk < HEAP_CHUNK) chunk = HEAP_CHUNK;
+    size_t increment = need > chunk ? need : chunk;
+    char *brk = sbrk(increment);
+    if (brk == (void *)-1) return NULL;
+    if (trimmed && trim_threshold < TRIM_THRESHOLD_MAX)
+        trim_threshold *= 2;
+    trimmed = 0;
+    heap_bytes += increment;
+
+    if (brk != heap_end) {
+        // Something else moved the break: start a new block at the old one
+        extend = 0;
+        pad = (ALIGNMENT - (uintptr_t)brk % ALIGNMENT) % ALIGNMENT;
+        if (increment < pad + BLOCK_SIZE + s) {
+            size_t more = pad + BLOCK_SIZE + s - increment;
+            if (sbrk(more) == (void *)-1) {
+                heap_end = brk + increment;
+                return NULL;
+            }
+            increment += more;
+            heap_bytes += more;
+        }
+    }
+    heap_end = brk + increment;
+
+    if (extend) {
+        top->size += increment;
+        return top;
+    }
+    block_t *block = (block_t *)(brk + pad);
+    block->size = increment - pad - BLOCK_SIZE;
+    block->free = 1;
+    block->next = NULL;
+    block->prev = top;
+    if (top) top->next = block;
+    else free_list = block;
+    heap_top = block;
+    return block;
+}
 
 /*
  * memory of size `s`
  * Looks for free space, if not found, gets more memory.
  */
 void *mymalloc(size_t s) {
-    block_t *current = free_list, *prev = NULL;
+    if (s > SIZE_MAX / 2) return NULL;
+    s = s ? (s + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1) : ALIGNMENT;
+    block_t *current = free_list;
     while (current && !(current->free && current->size >= s)) {
-        prev = current;
         current = current->next;
     }
-    if (current) { // if it is a free block
-        current->free = 0;
-        debug_printf("Malloc %zu\n", s);
-        return (void *)(current + 1);
+    if (!current) { // No free block, get more memory
+        current = grow_heap(s);
+        if (!current) return NULL;
     }
-    // No free block, get more memory
-    void *p = sbrk(s + BLOCK_SIZE);
-    if (p == (void *)-1) return NULL;
-    block_t *new_block = (block_t *)p;
-    new_block->size = s;
-    new_block->free = 0;
-    new_block->next = NULL;
-    if (prev) prev->next = new_block;
-    else free_list = new_block;
+    split(current, s);
+    current->free = 0;
     debug_printf("Malloc %zu\n", s);
-    return (void *)(new_block + 1);
+    return (void *)(current + 1);
 }
 
 /*
@@ -58,11 +204,15 @@ void *mycalloc(size_t mem, size_t s) {
 
 /*
  * Frees memory block
- * Marks block as free so it can be reused.
+ * Marks block as free, merges it with free neighbours and trims the top of
+ * the heap.
  */
 void myfree(void *ptr) {
     if (!ptr) return;
     block_t *block_ptr = (block_t *)ptr - 1;
     block_ptr->free = 1;
     debug_printf("Freed %zu\n", block_ptr->size);
+    merge_next(block_ptr);
+    if (block_ptr->prev) merge_next(block_ptr->prev);
+    trim_top();
 }
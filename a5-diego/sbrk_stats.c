@@ -39,11 +39,11 @@ void print_stats() {
       "==== sbrk stats ========================\n"
       "Total call count: %lu\n"
       "Total memory added: %lu\n"
-      //"Total memory returned: %lu\n"
+      "Total memory returned: %lu\n"
       "========================================\n",
       sbrk_stats.count,
-      sbrk_stats.added); /*,
-      //sbrk_stats.returned);*/
+      sbrk_stats.added,
+      sbrk_stats.returned);
 }
 
 
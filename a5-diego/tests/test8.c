@@ -0,0 +1,63 @@
+// Heap trimming test
+// freeing the memory at the top of the heap should move the break back down
+
+#ifndef DEMO_TEST
+#include <malloc.h>
+#else
+#include <stdlib.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <assert.h>
+
+#define COUNT 100
+#define SIZE (64 * 1024)
+
+// The break, read with the system call so that the sbrk stats only count
+// the allocator's calls
+static char *current_break(void) {
+  return (char *) syscall(SYS_brk, 0);
+}
+
+int main() {
+  fprintf(stderr,
+      "=======================================================================\n"
+      "This test allocates %d blocks of %d bytes and frees them again. The\n"
+      "break should grow in steps of doubling size, no more than 10 of them,\n"
+      "and go back down once the blocks are freed, so that the stats report\n"
+      "returned memory.\n"
+      "=======================================================================\n",
+      COUNT, SIZE);
+
+  char *blocks[COUNT];
+  char *start = current_break();
+  char *peak = start;
+  int steps = 0;
+  for (int i = 0; i < COUNT; i++) {
+    blocks[i] = (char *) malloc(SIZE);
+    assert(blocks[i] != NULL);
+    memset(blocks[i], i, SIZE);
+    if (current_break() != peak) {
+      peak = current_break();
+      steps++;
+    }
+  }
+  assert(peak - start >= COUNT * SIZE);
+#ifndef DEMO_TEST
+  assert(steps <= 10);
+#endif
+
+  for (int i = 0; i < COUNT; i++) {
+    assert(blocks[i][SIZE - 1] == (char) i);
+    free(blocks[i]);
+  }
+  char *end = current_break();
+  fprintf(stderr, "break grew by %ld bytes in %d steps and is now %ld bytes above the "
+          "start\n", (long) (peak - start), steps, (long) (end - start));
+  assert(end - start < 512 * 1024);
+
+  return 0;
+}
@@ -5,7 +5,7 @@
 
 void test_empty_array() {
     printf("Testing sorting on an empty array...\n");
-    long arr[] = {};
+    long arr[1];  // a zero-length array upsets gcc, none of it is read
     long *sorted = merge_sort(arr, 0);
     assert(sorted != NULL);
     free(sorted);
@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include "../tmsort.c"
+
+/**
+ * An empty, unlinked temporary file.
+ */
+int empty_file() {
+    FILE *file = tmpfile();
+    assert(file != NULL);
+    int fd = dup(fileno(file));
+    fclose(file);
+    return fd;
+}
+
+/**
+ * Sort count numbers of input externally with the given memory and check
+ * the result against merge_sort. Only the first given numbers are in the
+ * input, the rest are zeros.
+ */
+void check_external(const long input[], int given, int count, long memory, int binary) {
+    int in = empty_file(), out = empty_file();
+    if (binary) {
+        setenv("MSORT_IO", "binary", 1);
+        write_all(in, (const char *)input, given * sizeof(long));
+    } else {
+        unsetenv("MSORT_IO");
+        write_longs(in, input, given);
+    }
+    lseek(in, 0, SEEK_SET);
+    external_sort(in, out, count, memory);
+    unsetenv("MSORT_IO");
+
+    long *copy = calloc(count + 1, sizeof(long));
+    memcpy(copy, input, given * sizeof(long));
+    long *expected = merge_sort(copy, count);
+
+    long *sorted = calloc(count + 1, sizeof(long));
+    lseek(out, 0, SEEK_SET);
+    int n = binary ? read_binary(out, sorted, count + 1) : read_longs(out, sorted, count + 1);
+    assert(n == count);
+    assert(memcmp(sorted, expected, count * sizeof(long)) == 0);
+
+    close(in);
+    close(out);
+    free(copy);
+    free(expected);
+    free(sorted);
+}
+
+void test_external_sort() {
+    printf("Testing the external sort...\n");
+
+    int n = 1200000;
+    long *input = malloc(n * sizeof(long));
+    for (int i = 0; i < n; i++) input[i] = ((long)rand() << 31 | rand()) - (1L << 61);
+
+    // Many short runs, with levels of runs merged on the way
+    assert(n / RUN_BUFFER_MIN > EXTERNAL_FAN_IN);
+    check_external(input, n, n, 16 * 1024, 0);
+    check_external(input, n, n, 16 * 1024, 1);
+    // A few long runs
+    check_external(input, n, n, 1 << 20, 0);
+    check_external(input, n, n, 1 << 20, 1);
+    // Missing numbers count as zeros
+    check_external(input, n / 2, n, 1 << 20, 0);
+    check_external(input, 0, 0, 1 << 20, 0);
+
+    free(input);
+    printf("External sort test passed.\n");
+}
+
+void test_memory_from_env() {
+    printf("Testing MSORT_MEM...\n");
+
+    unsetenv("MSORT_MEM");
+    assert(memory_from_env() == 0);
+    setenv("MSORT_MEM", "4096", 1);
+    assert(memory_from_env() == 4096);
+    setenv("MSORT_MEM", "64K", 1);
+    assert(memory_from_env() == 64 << 10);
+    setenv("MSORT_MEM", "3G", 1);
+    assert(memory_from_env() == 3L << 30);
+    unsetenv("MSORT_MEM");
+
+    printf("MSORT_MEM test passed.\n");
+}
+
+void test_count_from_arg() {
+    printf("Testing the element count argument...\n");
+
+    assert(count_from_arg("0") == 0);
+    assert(count_from_arg("1000") == 1000);
+    // Counts beyond an int are left to the external sort
+    assert(count_from_arg("5000000000") == 5000000000L);
+    assert(count_from_arg("-1") == -1);
+    assert(count_from_arg("12x") == -1);
+    assert(count_from_arg("") == -1);
+    assert(count_from_arg("99999999999999999999") == -1);
+
+    printf("Element count test passed.\n");
+}
+
+void test_open_files() {
+    printf("Testing the external sort with few open files allowed...\n");
+
+    // Room for one level of runs, the merged run and a few more files
+    struct rlimit old_limit, limit;
+    getrlimit(RLIMIT_NOFILE, &old_limit);
+    limit = old_limit;
+    limit.rlim_cur = EXTERNAL_FAN_IN + 16;
+    assert(setrlimit(RLIMIT_NOFILE, &limit) == 0);
+
+    int n = 3 * (EXTERNAL_FAN_IN + 16) * RUN_BUFFER_MIN;
+    long *input = malloc(n * sizeof(long));
+    for (int i = 0; i < n; i++) input[i] = rand();
+    check_external(input, n, n, 16 * 1024, 1);
+
+    assert(setrlimit(RLIMIT_NOFILE, &old_limit) == 0);
+    free(input);
+    printf("Few open files test passed.\n");
+}
+
+int main() {
+    test_memory_from_env();
+    test_count_from_arg();
+    test_external_sort();
+    test_open_files();
+    return 0;
+}
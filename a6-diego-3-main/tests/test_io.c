@@ -0,0 +1,81 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include "../tmsort.c"
+
+/**
+ * A temporary file holding the given text, positioned at its start.
+ */
+int file_with(const char *text, size_t size) {
+    FILE *file = tmpfile();
+    assert(file != NULL);
+    int fd = dup(fileno(file));
+    fclose(file);
+    write_all(fd, text, size);
+    lseek(fd, 0, SEEK_SET);
+    return fd;
+}
+
+void test_read_longs() {
+    printf("Testing the number parser...\n");
+
+    const char *text = "42 -7\n\t+3  9223372036854775807\n-9223372036854775808 0 -0\n1";
+    long expected[] = {42, -7, 3, LONG_MAX, LONG_MIN, 0, 0, 1};
+    long numbers[10];
+
+    int fd = file_with(text, strlen(text));
+    assert(read_longs(fd, numbers, 10) == 8);
+    assert(memcmp(numbers, expected, sizeof(expected)) == 0);
+    close(fd);
+
+    fd = file_with(text, strlen(text));
+    assert(read_longs(fd, numbers, 3) == 3);
+    assert(memcmp(numbers, expected, 3 * sizeof(long)) == 0);
+    close(fd);
+
+    printf("Number parser test passed.\n");
+}
+
+void test_large_input() {
+    printf("Testing input and output across buffers...\n");
+
+    int n = 500000;
+    long *numbers = malloc(n * sizeof(long));
+    long *read_back = malloc(n * sizeof(long));
+    for (int i = 0; i < n; i++) numbers[i] = ((long)rand() << 32 | rand()) - (1L << 62);
+
+    int fd = file_with("", 0);
+    write_longs(fd, numbers, n);
+    off_t size = lseek(fd, 0, SEEK_END);
+    assert(size > IO_BUFFER_SIZE);
+
+    // scanf reads back the numbers that were written
+    FILE *printed = fdopen(dup(fd), "r");
+    fseek(printed, 0, SEEK_SET);
+    for (int i = 0; i < n; i++) {
+        long value;
+        assert(fscanf(printed, "%ld", &value) == 1 && value == numbers[i]);
+    }
+    fclose(printed);
+
+    lseek(fd, 0, SEEK_SET);
+    assert(read_longs(fd, read_back, n) == n);
+    assert(memcmp(numbers, read_back, n * sizeof(long)) == 0);
+    close(fd);
+
+    fd = file_with((const char *)numbers, n * sizeof(long));
+    memset(read_back, 0, n * sizeof(long));
+    assert(read_binary(fd, read_back, n) == n);
+    assert(memcmp(numbers, read_back, n * sizeof(long)) == 0);
+    close(fd);
+
+    free(numbers);
+    free(read_back);
+    printf("Input and output test passed.\n");
+}
+
+int main() {
+    test_read_longs();
+    test_large_input();
+    return 0;
+}
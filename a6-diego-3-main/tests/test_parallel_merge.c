@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <assert.h>
+#include "../tmsort.c"
+
+double get_time() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+int compare_longs(const void *a, const void *b) {
+    long x = *(const long *)a, y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+/** Two sorted halves of n random numbers in 0..range-1 */
+long *sorted_halves(int n, int range) {
+    long *nums = malloc(n * sizeof(long));
+    for (int i = 0; i < n; i++) nums[i] = rand() % range;
+    qsort(nums, n / 2, sizeof(long), compare_longs);
+    qsort(nums + n / 2, n - n / 2, sizeof(long), compare_longs);
+    return nums;
+}
+
+void test_co_rank() {
+    printf("Testing co_rank...\n");
+
+    long a[] = {1, 3, 3, 5};
+    long b[] = {2, 3, 4};
+    // merged: 1 2 3a 3a 3b 4 5, ties are taken from a first
+    int expected[] = {0, 1, 1, 2, 3, 3, 3, 4};
+    for (int k = 0; k <= 7; k++) {
+        assert(co_rank(k, a, 4, b, 3) == expected[k]);
+    }
+    long low[] = {1, 2}, high[] = {8, 9};
+    assert(co_rank(2, low, 2, high, 2) == 2);
+    assert(co_rank(2, high, 2, low, 2) == 0);
+
+    printf("co_rank test passed.\n");
+}
+
+void test_parallel_merge() {
+    printf("Testing parallel merge with 4 threads...\n");
+
+    int n = 1 << 22;
+    int ranges[] = {10, 1000000};
+    for (int r = 0; r < 2; r++) {
+        long *nums = sorted_halves(n, ranges[r]);
+        long *expected = malloc(n * sizeof(long));
+        long *target = malloc(n * sizeof(long));
+
+        merge(nums, 0, n / 2, n, expected);
+        double start = get_time();
+        assert(pool_begin());
+        parallel_merge(nums, 0, n / 2, n, target);
+        pool_end();
+        double end = get_time();
+        assert(memcmp(target, expected, n * sizeof(long)) == 0);
+        printf("Merged %d elements in %f seconds.\n", n, end - start);
+
+        free(nums);
+        free(expected);
+        free(target);
+    }
+    printf("Parallel merge test passed.\n");
+}
+
+void test_merge_share() {
+    printf("Timing the top-level merge against the whole sort...\n");
+
+    int n = 1 << 23;
+    long *arr = malloc(n * sizeof(long));
+    for (int i = 0; i < n; i++) arr[i] = rand();
+    double start = get_time();
+    long *sorted = merge_sort(arr, n);
+    double sort_time = get_time() - start;
+
+    long *halves = sorted_halves(n, RAND_MAX);
+    start = get_time();
+    merge(halves, 0, n / 2, n, sorted);
+    double sequential = get_time() - start;
+    start = get_time();
+    pool_begin();
+    parallel_merge(halves, 0, n / 2, n, sorted);
+    pool_end();
+    double parallel = get_time() - start;
+
+    printf("Sorting %d elements took %f seconds. A sequential top-level merge takes\n"
+           "%f seconds (%.0f%%), the parallel one %f seconds (%.0f%%).\n",
+           n, sort_time, sequential, 100 * sequential / sort_time,
+           parallel, 100 * parallel / sort_time);
+
+    free(arr);
+    free(sorted);
+    free(halves);
+}
+
+int main() {
+    setenv("MSORT_THREADS", "4", 1);
+    test_co_rank();
+    test_parallel_merge();
+    test_merge_share();
+    return 0;
+}
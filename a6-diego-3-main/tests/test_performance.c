@@ -9,6 +9,25 @@ double get_time() {
     return tv.tv_sec + tv.tv_usec / 1000000.0;
 }
 
+/**
+ * Sort a copy of input with the given leaf size and return the seconds taken.
+ */
+double time_sort(const long *input, int n, int cutoff) {
+    long *arr = malloc(n * sizeof(long));
+    memcpy(arr, input, n * sizeof(long));
+
+    leaf_cutoff = cutoff;
+    double start = get_time();
+    long *sorted = merge_sort(arr, n);
+    double end = get_time();
+
+    for (int i = 1; i < n; i++) assert(sorted[i - 1] <= sorted[i]);
+
+    free(arr);
+    free(sorted);
+    return end - start;
+}
+
 void test_performance() {
     printf("Testing sorting performance...\n");
 
@@ -17,18 +36,37 @@ void test_performance() {
 
     for (int i = 0; i < n; i++) arr[i] = rand() % 100000;
 
-    double start = get_time();
-    long *sorted = merge_sort(arr, n);
-    double end = get_time();
-
-    printf("Sorting %d elements took %f seconds.\n", n, end - start);
+    double seconds = time_sort(arr, n, LEAF_CUTOFF);
+    printf("Sorting %d elements took %f seconds.\n", n, seconds);
 
     free(arr);
-    free(sorted);
     printf("Performance test completed.\n");
 }
 
+void test_leaf_speedup() {
+    printf("Testing leaf sort speedup...\n");
+
+    int n = 1000000;
+    long *arr = malloc(n * sizeof(long));
+
+    for (int i = 0; i < n; i++) arr[i] = rand();
+
+    double plain = time_sort(arr, n, 1);
+    printf("Leaf size 1: %f seconds.\n", plain);
+    int cutoffs[] = {8, 16, 32};
+    for (int i = 0; i < 3; i++) {
+        double seconds = time_sort(arr, n, cutoffs[i]);
+        printf("Leaf size %d: %f seconds, speedup %.2fx.\n",
+               cutoffs[i], seconds, plain / seconds);
+    }
+    leaf_cutoff = LEAF_CUTOFF;
+
+    free(arr);
+    printf("Leaf sort speedup test completed.\n");
+}
+
 int main() {
     test_performance();
+    test_leaf_speedup();
     return 0;
 }
@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <sys/time.h>
+#include "../tmsort.c"
+
+double get_time() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/**
+ * Sort copies of arr with both sorts and check that the results are the same.
+ */
+void check_same(const long *arr, int n) {
+    long *a = malloc((n + 1) * sizeof(long));
+    long *b = malloc((n + 1) * sizeof(long));
+    memcpy(a, arr, n * sizeof(long));
+    memcpy(b, arr, n * sizeof(long));
+
+    long *expected = merge_sort(a, n);
+    long *sorted = radix_sort(b, n);
+    assert(memcmp(expected, sorted, n * sizeof(long)) == 0);
+
+    free(a);
+    free(b);
+    free(expected);
+    free(sorted);
+}
+
+void test_radix_edge_cases() {
+    printf("Testing radix sort edge cases...\n");
+
+    long extremes[] = {LONG_MAX, -1, 0, LONG_MIN, 1, LONG_MIN + 1, LONG_MAX - 1, -256, 255};
+    check_same(extremes, 0);
+    check_same(extremes, 1);
+    check_same(extremes, sizeof(extremes) / sizeof(extremes[0]));
+
+    long same[100];
+    for (int i = 0; i < 100; i++) same[i] = -42;
+    check_same(same, 100);
+
+    printf("Radix sort edge cases passed.\n");
+}
+
+void test_radix_random() {
+    printf("Testing radix sort on random input...\n");
+
+    int n = 1000000;
+    long *arr = malloc(n * sizeof(long));
+    long ranges[] = {10, 1000000, 0};
+    for (int r = 0; r < 3; r++) {
+        for (int i = 0; i < n; i++) {
+            long value = ((long)rand() << 33) ^ ((long)rand() << 2) ^ rand();
+            arr[i] = ranges[r] ? value % ranges[r] : value;
+        }
+        check_same(arr, n);
+    }
+
+    free(arr);
+    printf("Radix sort random test passed.\n");
+}
+
+void test_radix_threads() {
+    printf("Testing radix sort with 4 threads...\n");
+
+    setenv("MSORT_THREADS", "4", 1);
+    int n = 4000000;
+    long *arr = malloc(n * sizeof(long));
+    long *copy = malloc(n * sizeof(long));
+    for (int i = 0; i < n; i++) arr[i] = ((long)rand() << 31) - rand();
+    check_same(arr, n);
+    assert(worker_count == 4);
+
+    memcpy(copy, arr, n * sizeof(long));
+    double start = get_time();
+    long *sorted = merge_sort(copy, n);
+    double merge_time = get_time() - start;
+    free(sorted);
+
+    memcpy(copy, arr, n * sizeof(long));
+    start = get_time();
+    sorted = radix_sort(copy, n);
+    double radix_time = get_time() - start;
+    free(sorted);
+
+    printf("Sorting %d elements took %f seconds with merge sort, %f with radix sort.\n",
+           n, merge_time, radix_time);
+
+    free(arr);
+    free(copy);
+    printf("Radix sort thread test passed.\n");
+}
+
+int main() {
+    test_radix_edge_cases();
+    test_radix_random();
+    test_radix_threads();
+    return 0;
+}
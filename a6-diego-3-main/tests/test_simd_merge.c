@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include "../tmsort.c"
+
+const char *kernel_names[] = {"scalar", "avx2", "avx512"};
+
+double get_time() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+int compare_longs(const void *a, const void *b) {
+    long x = *(const long *)a, y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Fill a[0, n) with sorted values below range.
+ */
+void fill_sorted(long a[], int n, long range) {
+    for (int i = 0; i < n; i++) a[i] = rand() % range;
+    qsort(a, n, sizeof(long), compare_longs);
+}
+
+void test_kernels() {
+    printf("Testing merge kernels against the scalar merge...\n");
+
+    int sizes[] = {0, 1, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 100, 1000};
+    int count = sizeof(sizes) / sizeof(sizes[0]);
+    long ranges[] = {3, 1000, 1L << 40};
+    long a[1000], b[1000], expected[2000], out[2001];
+
+    for (int k = 0; k < 3; k++) {
+        MergeKernel kernel = find_merge_kernel(kernel_names[k]);
+        if (kernel == NULL) {
+            printf("%s is not supported, skipped.\n", kernel_names[k]);
+            continue;
+        }
+        for (int r = 0; r < 3; r++) {
+            for (int i = 0; i < count; i++) {
+                for (int j = 0; j < count; j++) {
+                    int na = sizes[i], nb = sizes[j];
+                    fill_sorted(a, na, ranges[r]);
+                    fill_sorted(b, nb, ranges[r]);
+                    // One side entirely below the other now and then
+                    if (r == 2 && (i + j) % 3 == 0) {
+                        for (int x = 0; x < nb; x++) b[x] += ranges[r];
+                    }
+                    merge_scalar(a, na, b, nb, expected);
+                    out[na + nb] = -1;
+                    kernel(a, na, b, nb, out);
+                    assert(memcmp(out, expected, (na + nb) * sizeof(long)) == 0);
+                    assert(out[na + nb] == -1);
+                }
+            }
+        }
+        printf("%s kernel passed.\n", kernel_names[k]);
+    }
+}
+
+void test_throughput() {
+    printf("Measuring merge throughput...\n");
+
+    int n = 1 << 22;
+    long *a = malloc(n * sizeof(long));
+    long *b = malloc(n * sizeof(long));
+    long *out = malloc(2 * n * sizeof(long));
+    assert(a != NULL && b != NULL && out != NULL);
+    fill_sorted(a, n, 1L << 40);
+    fill_sorted(b, n, 1L << 40);
+
+    for (int k = 0; k < 3; k++) {
+        MergeKernel kernel = find_merge_kernel(kernel_names[k]);
+        if (kernel == NULL) continue;
+        kernel(a, n, b, n, out);    // fault the output in
+        int rounds = 5;
+        double start = get_time();
+        for (int i = 0; i < rounds; i++) kernel(a, n, b, n, out);
+        double seconds = (get_time() - start) / rounds;
+        printf("%-6s merged %d longs in %f seconds, %.2f GB/s of output.\n",
+               kernel_names[k], 2 * n, seconds, 2.0 * n * sizeof(long) / seconds / 1e9);
+    }
+    printf("merge uses the %s kernel.\n",
+           get_merge_kernel() == merge_scalar ? "scalar" :
+           get_merge_kernel() == find_merge_kernel("avx512") ? "avx512" : "avx2");
+
+    free(a);
+    free(b);
+    free(out);
+}
+
+int main() {
+    test_kernels();
+    test_throughput();
+    return 0;
+}
@@ -22,7 +22,35 @@ void test_thread_usage() {
     printf("Threaded sorting test passed.\n");
 }
 
+void test_thread_pool() {
+    printf("Testing the thread pool on a large array...\n");
+
+    int n = 1000000;
+    long *arr = malloc(n * sizeof(long));
+    long sum = 0;
+    for (int i = 0; i < n; i++) {
+        arr[i] = rand() % 1000000;
+        sum += arr[i];
+    }
+
+    // The pool was started by the first sort and is reused
+    long *sorted = merge_sort(arr, n);
+    assert(worker_count == 4);
+
+    long sorted_sum = sorted[0];
+    for (int i = 0; i < n - 1; i++) {
+        assert(sorted[i] <= sorted[i + 1]);
+        sorted_sum += sorted[i + 1];
+    }
+    assert(sorted_sum == sum);
+
+    free(arr);
+    free(sorted);
+    printf("Thread pool test passed.\n");
+}
+
 int main() {
     test_thread_usage();
+    test_thread_pool();
     return 0;
 }
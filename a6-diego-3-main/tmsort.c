@@ -6,10 +6,13 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
 #include <string.h>
 #include <sys/time.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <sched.h>
 #include <assert.h>
 #include "tsmort.h"
 
@@ -21,17 +24,69 @@
 #define log(...)
 #endif
 
-/** Struct for passing arguments to threads */
-typedef struct {
+/**
+ * A slice to sort, or a piece of a merge, run as a task by the pool. A
+ * merge piece merges nums[from, mid) and nums[right, to) into target
+ * starting at at.
+ */
+typedef struct SortA {
     long *nums;
     int from;
     int to;
     long *target;
+    int done;       // set once the task has run, accessed atomically
+    int mid;        // merge pieces only
+    int right;
+    int at;
+    void (*run)(struct SortA *task);
 } SortA;
 
 /** The number of threads to be used for sorting. Default: 1 */
 int thread_count = 1;
 
+/**
+ * Work-stealing pool.
+ *
+ * thread_count - 1 worker threads are started by the first merge_sort and
+ * kept until the program exits; the thread calling merge_sort is the last
+ * worker. Each worker has a deque of tasks: it pushes the first half of a
+ * slice it splits at the bottom, sorts the second half itself and then pops
+ * the first half back, unless an idle worker stole it from the top in the
+ * meantime. While waiting for a stolen half, a worker steals other tasks.
+ * Slices of up to PARALLEL_CUTOFF elements are sorted sequentially.
+ *
+ * The two sorted halves are merged in parallel as long as other workers are
+ * idle: co_rank splits the output into pieces of at least MERGE_CUTOFF
+ * elements that can be merged independently, and the pieces are pushed as
+ * tasks like the halves.
+ *
+ * A deque holds one task per level of recursion and the pieces of one
+ * merge, so DEQUE_SIZE is never reached for int-sized arrays. A task that
+ * does not fit is run right away.
+ */
+#define PARALLEL_CUTOFF (1 << 14)
+#define MERGE_CUTOFF (1 << 15)
+#define MERGE_PIECES_MAX 32
+#define DEQUE_SIZE 128
+
+typedef struct {
+    pthread_mutex_t lock;
+    SortA *tasks[DEQUE_SIZE];
+    int top;        // next task to steal
+    int bottom;     // next free slot
+    unsigned int seed;
+    pthread_t thread;
+} Worker;
+
+static Worker *workers = NULL;
+static int worker_count = 0;
+static int sorting = 0;     // a sort is running, set under pool_lock
+static int idle_count = 0;  // workers looking for a task, accessed atomically
+static int stopping = 0;    // the program exits, protected by pool_lock
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_wake = PTHREAD_COND_INITIALIZER;
+static __thread Worker *self = NULL;
+
 /**
  * Compute the delta between the given timevals in seconds.
  */
@@ -42,33 +97,451 @@ double time_in_secs(const struct timeval *begin, const struct timeval *end) {
 }
 
 /**
- * Print the given array of longs, an element per line.
+ * Input and output.
+ *
+ * Numbers are read and written through IO_BUFFER_SIZE buffers with one
+ * read or write call per buffer, and parsed and formatted by hand instead
+ * of by scanf and printf per element. With MSORT_IO=binary the numbers are
+ * raw longs in the machine's byte order instead of text.
+ */
+#define IO_BUFFER_SIZE (1 << 20)
+
+/**
+ * Whether MSORT_IO asks for binary input and output.
+ */
+static int binary_from_env(void) {
+    char *io = getenv("MSORT_IO");
+    return io != NULL && strcmp(io, "binary") == 0;
+}
+
+/**
+ * A buffered reader of text numbers. It only stops after the separator that
+ * ends a number, so it can be asked for more numbers later on.
+ */
+typedef struct {
+    int fd;
+    char *buf;
+    ssize_t pos;
+    ssize_t end;
+} Reader;
+
+static void reader_init(Reader *reader, int fd) {
+    reader->fd = fd;
+    reader->buf = malloc(IO_BUFFER_SIZE);
+    assert(reader->buf != NULL);
+    reader->pos = reader->end = 0;
+}
+
+/**
+ * Read up to count whitespace-separated numbers into array. Returns the
+ * number of numbers read.
+ */
+static int reader_longs(Reader *reader, long array[], int count) {
+    int n = 0;
+    unsigned long value = 0;
+    int negative = 0, digits = 0;
+    while (n < count) {
+        if (reader->pos == reader->end) {
+            reader->end = read(reader->fd, reader->buf, IO_BUFFER_SIZE);
+            reader->pos = 0;
+            if (reader->end <= 0) {
+                reader->end = 0;
+                break;
+            }
+        }
+        char c = reader->buf[reader->pos++];
+        unsigned int digit = (unsigned char)c - '0';
+        if (digit < 10) {
+            value = value * 10 + digit;
+            digits++;
+        } else if (digits > 0) {
+            array[n++] = (long)(negative ? -value : value);
+            value = 0;
+            negative = digits = 0;
+        } else {
+            negative = c == '-';
+        }
+    }
+    if (digits > 0 && n < count) {
+        array[n++] = (long)(negative ? -value : value);
+    }
+    return n;
+}
+
+/**
+ * Read up to count whitespace-separated numbers from fd into array. Returns
+ * the number of numbers read.
+ */
+int read_longs(int fd, long array[], int count) {
+    Reader reader;
+    reader_init(&reader, fd);
+    int n = reader_longs(&reader, array, count);
+    free(reader.buf);
+    return n;
+}
+
+/**
+ * Read up to count raw longs from fd into array. Returns the number read.
+ */
+int read_binary(int fd, long array[], int count) {
+    char *into = (char *)array;
+    size_t size = (size_t)count * sizeof(long), done = 0;
+    ssize_t got;
+    while (done < size && (got = read(fd, into + done, size - done)) > 0) {
+        done += got;
+    }
+    return done / sizeof(long);
+}
+
+/**
+ * Write all of buf to fd.
+ */
+static void write_all(int fd, const char *buf, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(fd, buf, size);
+        if (written <= 0) {
+            perror("write");
+            exit(1);
+        }
+        buf += written;
+        size -= written;
+    }
+}
+
+/**
+ * A buffered writer of numbers, as text lines or as raw longs.
+ */
+typedef struct {
+    int fd;
+    int binary;
+    char *buf;
+    size_t used;
+} Writer;
+
+static void writer_init(Writer *writer, int fd, int binary) {
+    writer->fd = fd;
+    writer->binary = binary;
+    writer->buf = malloc(IO_BUFFER_SIZE);
+    assert(writer->buf != NULL);
+    writer->used = 0;
+}
+
+static void writer_put(Writer *writer, long number) {
+    // A long takes at most 20 characters and a newline
+    if (writer->used > IO_BUFFER_SIZE - 21) {
+        write_all(writer->fd, writer->buf, writer->used);
+        writer->used = 0;
+    }
+    char *buf = writer->buf;
+    size_t used = writer->used;
+    if (writer->binary) {
+        memcpy(&buf[used], &number, sizeof(long));
+        writer->used = used + sizeof(long);
+        return;
+    }
+    unsigned long value = number < 0 ? -(unsigned long)number : number;
+    char digits[20];
+    int length = 0;
+    do {
+        digits[length++] = '0' + value % 10;
+        value /= 10;
+    } while (value > 0);
+    if (number < 0) buf[used++] = '-';
+    while (length > 0) buf[used++] = digits[--length];
+    buf[used++] = '\n';
+    writer->used = used;
+}
+
+/**
+ * Write out what is left in the buffer and free it.
+ */
+static void writer_close(Writer *writer) {
+    write_all(writer->fd, writer->buf, writer->used);
+    free(writer->buf);
+    writer->buf = NULL;
+}
+
+/**
+ * Write the given array of longs to fd, an element per line.
+ */
+void write_longs(int fd, const long array[], int count) {
+    Writer writer;
+    writer_init(&writer, fd, 0);
+    for (int i = 0; i < count; i++) {
+        writer_put(&writer, array[i]);
+    }
+    writer_close(&writer);
+}
+/**
+ * Print the given array of longs, an element per line, or as raw longs with
+ * MSORT_IO=binary.
  */
 void print_long_array(const long *array, int count) {
-    for (int i = 0; i < count; ++i) {
-        printf("%ld\n", array[i]);
+    fflush(stdout);
+    if (binary_from_env()) {
+        write_all(1, (const char *)array, (size_t)count * sizeof(long));
+    } else {
+        write_longs(1, array, count);
     }
 }
 
 /**
- * Merge two slices of nums into the corresponding portion of target.
+ * Merge kernels.
+ *
+ * A kernel merges the sorted arrays a and b into out. The scalar kernel
+ * branches on every comparison, which random input mispredicts about half
+ * of the time. The vector kernels keep the next W outputs in a register
+ * instead: they merge W elements from each side with a bitonic network,
+ * store the smaller half and merge the larger half with the next W elements
+ * of the side whose next element is smaller (W is 4 longs for AVX2 and 8
+ * for AVX-512). The last elements are merged by the scalar kernel.
+ *
+ * The fastest kernel the CPU supports is picked on first use. MSORT_SIMD
+ * set to scalar, avx2 or avx512 limits the choice, for comparing them.
  */
-void merge(long nums[], int from, int mid, int to, long target[]) {
-    int left = from;
-    int right = mid;
-    int i = from;
+typedef void (*MergeKernel)(const long a[], int na, const long b[], int nb, long out[]);
 
-    while (i < to && left < mid && right < to) {
-        if (nums[left] <= nums[right]) {
-            target[i++] = nums[left++];
+static void merge_scalar(const long a[], int na, const long b[], int nb, long out[]) {
+    int i = 0, j = 0, k = 0;
+    while (i < na && j < nb) {
+        if (a[i] <= b[j]) {
+            out[k++] = a[i++];
         } else {
-            target[i++] = nums[right++];
+            out[k++] = b[j++];
         }
     }
-    if (left < mid) {
-        memmove(&target[i], &nums[left], (mid - left) * sizeof(long));
-    } else if (right < to) {
-        memmove(&target[i], &nums[right], (to - right) * sizeof(long));
+    if (i < na) {
+        memmove(&out[k], &a[i], (na - i) * sizeof(long));
+    } else if (j < nb) {
+        memmove(&out[k], &b[j], (nb - j) * sizeof(long));
+    }
+}
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+
+/**
+ * Merge the sorted lanes left in a vector register with the rest of a and b,
+ * one of which is shorter than the vector.
+ */
+static void merge_tail(const long lanes[], int width, const long a[], int na,
+                       const long b[], int nb, long out[]) {
+    long buf[16];
+    if (na < width) {
+        merge_scalar(lanes, width, a, na, buf);
+        merge_scalar(buf, width + na, b, nb, out);
+    } else {
+        merge_scalar(lanes, width, b, nb, buf);
+        merge_scalar(buf, width + nb, a, na, out);
+    }
+}
+
+__attribute__((target("avx2")))
+static inline void minmax_avx2(__m256i x, __m256i y, __m256i *lo, __m256i *hi) {
+    __m256i gt = _mm256_cmpgt_epi64(x, y);
+    *lo = _mm256_blendv_epi8(x, y, gt);
+    *hi = _mm256_blendv_epi8(y, x, gt);
+}
+
+/**
+ * Sort a bitonic vector of 4 longs.
+ */
+__attribute__((target("avx2")))
+static inline __m256i bitonic_sort4(__m256i x) {
+    __m256i lo, hi;
+    minmax_avx2(x, _mm256_permute4x64_epi64(x, 0x4e), &lo, &hi);
+    x = _mm256_blend_epi32(lo, hi, 0xf0);
+    minmax_avx2(x, _mm256_shuffle_epi32(x, 0x4e), &lo, &hi);
+    return _mm256_blend_epi32(lo, hi, 0xcc);
+}
+
+/**
+ * Merge the sorted vectors *a and *b, leaving the 4 smallest longs in *a
+ * and the 4 largest in *b.
+ */
+__attribute__((target("avx2")))
+static inline void bitonic_merge4(__m256i *a, __m256i *b) {
+    __m256i lo, hi;
+    minmax_avx2(*a, _mm256_permute4x64_epi64(*b, 0x1b), &lo, &hi);
+    *a = bitonic_sort4(lo);
+    *b = bitonic_sort4(hi);
+}
+
+__attribute__((target("avx2")))
+static void merge_avx2(const long a[], int na, const long b[], int nb, long out[]) {
+    if (na < 4 || nb < 4) {
+        merge_scalar(a, na, b, nb, out);
+        return;
+    }
+    const long *a_end = a + na, *b_end = b + nb;
+    __m256i lo = _mm256_loadu_si256((const __m256i *)a);
+    __m256i hi = _mm256_loadu_si256((const __m256i *)b);
+    a += 4;
+    b += 4;
+    for (;;) {
+        bitonic_merge4(&lo, &hi);
+        _mm256_storeu_si256((__m256i *)out, lo);
+        out += 4;
+        if (a_end - a < 4 || b_end - b < 4) break;
+        int take_a = *a <= *b;
+        lo = _mm256_loadu_si256((const __m256i *)(take_a ? a : b));
+        a += take_a * 4;
+        b += (1 - take_a) * 4;
+    }
+    long lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, hi);
+    merge_tail(lanes, 4, a, a_end - a, b, b_end - b, out);
+}
+
+/**
+ * Sort a bitonic vector of 8 longs.
+ */
+__attribute__((target("avx512f")))
+static inline __m512i bitonic_sort8(__m512i x) {
+    __m512i y = _mm512_shuffle_i64x2(x, x, 0x4e);
+    x = _mm512_mask_blend_epi64(0xf0, _mm512_min_epi64(x, y), _mm512_max_epi64(x, y));
+    y = _mm512_permutex_epi64(x, 0x4e);
+    x = _mm512_mask_blend_epi64(0xcc, _mm512_min_epi64(x, y), _mm512_max_epi64(x, y));
+    y = _mm512_shuffle_epi32(x, 0x4e);
+    return _mm512_mask_blend_epi64(0xaa, _mm512_min_epi64(x, y), _mm512_max_epi64(x, y));
+}
+
+/**
+ * Merge the sorted vectors *a and *b, leaving the 8 smallest longs in *a
+ * and the 8 largest in *b.
+ */
+__attribute__((target("avx512f")))
+static inline void bitonic_merge8(__m512i *a, __m512i *b) {
+    __m512i reversed = _mm512_permutexvar_epi64(_mm512_set_epi64(0, 1, 2, 3, 4, 5, 6, 7), *b);
+    __m512i lo = _mm512_min_epi64(*a, reversed);
+    __m512i hi = _mm512_max_epi64(*a, reversed);
+    *a = bitonic_sort8(lo);
+    *b = bitonic_sort8(hi);
+}
+
+__attribute__((target("avx512f")))
+static void merge_avx512(const long a[], int na, const long b[], int nb, long out[]) {
+    if (na < 8 || nb < 8) {
+        merge_scalar(a, na, b, nb, out);
+        return;
+    }
+    const long *a_end = a + na, *b_end = b + nb;
+    __m512i lo = _mm512_loadu_si512(a);
+    __m512i hi = _mm512_loadu_si512(b);
+    a += 8;
+    b += 8;
+    for (;;) {
+        bitonic_merge8(&lo, &hi);
+        _mm512_storeu_si512(out, lo);
+        out += 8;
+        if (a_end - a < 8 || b_end - b < 8) break;
+        int take_a = *a <= *b;
+        lo = _mm512_loadu_si512(take_a ? a : b);
+        a += take_a * 8;
+        b += (1 - take_a) * 8;
+    }
+    long lanes[8];
+    _mm512_storeu_si512(lanes, hi);
+    merge_tail(lanes, 8, a, a_end - a, b, b_end - b, out);
+}
+#endif
+
+/**
+ * The kernel called name, or NULL if there is none by that name the CPU can
+ * run. A NULL name asks for the fastest one.
+ */
+MergeKernel find_merge_kernel(const char *name) {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if ((name == NULL || strcmp(name, "avx512") == 0) && __builtin_cpu_supports("avx512f")) {
+        return merge_avx512;
+    }
+    if ((name == NULL || strcmp(name, "avx2") == 0) && __builtin_cpu_supports("avx2")) {
+        return merge_avx2;
+    }
+#endif
+    if (name == NULL || strcmp(name, "scalar") == 0) {
+        return merge_scalar;
+    }
+    return NULL;
+}
+
+/** The kernel used by merge, picked on first use. Accessed atomically. */
+static MergeKernel merge_kernel = NULL;
+
+static MergeKernel get_merge_kernel(void) {
+    MergeKernel kernel = __atomic_load_n(&merge_kernel, __ATOMIC_RELAXED);
+    if (kernel == NULL) {
+        kernel = find_merge_kernel(getenv("MSORT_SIMD"));
+        if (kernel == NULL) kernel = find_merge_kernel(NULL);
+        __atomic_store_n(&merge_kernel, kernel, __ATOMIC_RELAXED);
+    }
+    return kernel;
+}
+
+/**
+ * Merge nums[left, left_end) and nums[right, right_end) into target starting at at.
+ */
+static void merge_ranges(long nums[], int left, int left_end, int right, int right_end,
+                         long target[], int at) {
+    get_merge_kernel()(&nums[left], left_end - left, &nums[right], right_end - right,
+                       &target[at]);
+}
+
+/**
+ * Merge two slices of nums into the corresponding portion of target.
+ */
+void merge(long nums[], int from, int mid, int to, long target[]) {
+    merge_ranges(nums, from, mid, mid, to, target, from);
+}
+
+/**
+ * Leaf sort.
+ *
+ * Slices of up to leaf_cutoff elements are not split any further but sorted
+ * in place: every run of 8 elements goes through a sorting network of 19
+ * branchless compare-exchanges, and an insertion sort over the slice then
+ * merges the runs and places a shorter tail. A leaf_cutoff of 1 recurses
+ * down to single elements.
+ */
+#define LEAF_CUTOFF 32
+
+/** Slices of up to this many elements are sorted without recursion. */
+int leaf_cutoff = LEAF_CUTOFF;
+
+#define CSWAP(a, i, j) do {                     \
+        long x_ = (a)[i], y_ = (a)[j];          \
+        (a)[i] = x_ < y_ ? x_ : y_;             \
+        (a)[j] = x_ < y_ ? y_ : x_;             \
+    } while (0)
+
+/**
+ * Sort the 8 elements starting at a.
+ */
+static void sort_network8(long a[]) {
+    CSWAP(a, 0, 2); CSWAP(a, 1, 3); CSWAP(a, 4, 6); CSWAP(a, 5, 7);
+    CSWAP(a, 0, 4); CSWAP(a, 1, 5); CSWAP(a, 2, 6); CSWAP(a, 3, 7);
+    CSWAP(a, 0, 1); CSWAP(a, 2, 3); CSWAP(a, 4, 5); CSWAP(a, 6, 7);
+    CSWAP(a, 2, 4); CSWAP(a, 3, 5);
+    CSWAP(a, 1, 4); CSWAP(a, 3, 6);
+    CSWAP(a, 1, 2); CSWAP(a, 3, 4); CSWAP(a, 5, 6);
+}
+
+/**
+ * Sort nums[from, to) in place.
+ */
+static void leaf_sort(long nums[], int from, int to) {
+    for (int i = from; i + 8 <= to; i += 8) {
+        sort_network8(&nums[i]);
+    }
+    for (int i = from + 1; i < to; i++) {
+        long value = nums[i];
+        int j = i;
+        while (j > from && nums[j - 1] > value) {
+            nums[j] = nums[j - 1];
+            j--;
+        }
+        nums[j] = value;
     }
 }
 
@@ -78,37 +551,309 @@ void merge(long nums[], int from, int mid, int to, long target[]) {
  * Warning: nums gets overwritten.
  */
 void merge_sort_aux(long nums[], int from, int to, long target[]) {
-    if (to - from <= 1) return;
+    // Both arrays hold the slice on entry, so a leaf is sorted in target
+    if (to - from <= leaf_cutoff) {
+        if (to - from > 1) leaf_sort(target, from, to);
+        return;
+    }
 
     int mid = (from + to) / 2;
-    pthread_t thread;
-    SortA args = {target, from, mid, nums};
+    merge_sort_aux(target, from, mid, nums);
+    merge_sort_aux(target, mid, to, nums);
+    merge(nums, from, mid, to, target);
+}
+
+/**
+ * Push a task onto the bottom of the worker's deque. Returns 0 if it is full.
+ */
+static int deque_push(Worker *worker, SortA *task) {
+    pthread_mutex_lock(&worker->lock);
+    int pushed = worker->bottom < DEQUE_SIZE;
+    if (pushed) {
+        worker->tasks[worker->bottom++] = task;
+    }
+    pthread_mutex_unlock(&worker->lock);
+    return pushed;
+}
+
+/**
+ * Pop the task at the bottom of the worker's own deque, NULL if it is empty.
+ */
+static SortA *deque_pop(Worker *worker) {
+    pthread_mutex_lock(&worker->lock);
+    SortA *task = NULL;
+    if (worker->top < worker->bottom) {
+        task = worker->tasks[--worker->bottom];
+    }
+    if (worker->top == worker->bottom) {
+        worker->top = worker->bottom = 0;
+    }
+    pthread_mutex_unlock(&worker->lock);
+    return task;
+}
 
-    int create_thread = (thread_count > 1);
-    if (create_thread) {
-        thread_count--;
-        pthread_create(&thread, NULL, threaded_merge_sort, &args);
+/**
+ * Take the oldest task of a random other worker, NULL if it has none.
+ */
+static SortA *steal(Worker *thief) {
+    Worker *victim = &workers[rand_r(&thief->seed) % worker_count];
+    if (victim == thief) return NULL;
+
+    pthread_mutex_lock(&victim->lock);
+    SortA *task = NULL;
+    if (victim->top < victim->bottom) {
+        task = victim->tasks[victim->top++];
+    }
+    pthread_mutex_unlock(&victim->lock);
+    return task;
+}
+
+/**
+ * Run a task and mark it done.
+ */
+static void run_task(SortA *task) {
+    task->run(task);
+    __atomic_store_n(&task->done, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Steal a task and run it, or yield if there is none. The worker counts as
+ * idle except while it runs the task.
+ */
+static void steal_and_run(void) {
+    SortA *task = steal(self);
+    if (task != NULL) {
+        __atomic_sub_fetch(&idle_count, 1, __ATOMIC_RELAXED);
+        run_task(task);
+        __atomic_add_fetch(&idle_count, 1, __ATOMIC_RELAXED);
     } else {
-        merge_sort_aux(target, from, mid, nums);
+        sched_yield();
     }
+}
 
-    merge_sort_aux(target, mid, to, nums);
+/**
+ * Push a task for other workers to steal, or run it now if the deque is full.
+ */
+static void task_spawn(SortA *task) {
+    if (!deque_push(self, task)) {
+        run_task(task);
+    }
+}
 
-    if (create_thread) {
-        pthread_join(thread, NULL);
-        thread_count++;
+/**
+ * Wait until a task spawned by this worker is done. Tasks are synced in the
+ * reverse order of spawning, so the task is either at the bottom of the
+ * deque or was stolen, in which case the deque holds nothing newer and pop
+ * finds it empty. While it waits, the worker runs tasks of others.
+ */
+static void task_sync(SortA *task) {
+    if (__atomic_load_n(&task->done, __ATOMIC_ACQUIRE)) return;
+
+    SortA *popped = deque_pop(self);
+    if (popped != NULL) {
+        assert(popped == task);
+        run_task(popped);
+        return;
+    }
+    __atomic_add_fetch(&idle_count, 1, __ATOMIC_RELAXED);
+    while (!__atomic_load_n(&task->done, __ATOMIC_ACQUIRE)) {
+        steal_and_run();
     }
+    __atomic_sub_fetch(&idle_count, 1, __ATOMIC_RELAXED);
+}
 
-    merge(nums, from, mid, to, target);
+static void run_merge(SortA *task) {
+    merge_ranges(task->nums, task->from, task->mid, task->right, task->to,
+                 task->target, task->at);
 }
 
 /**
- * Threaded function for merge sort.
+ * How many of the first k elements of the merge of a[0, m) and b[0, n) come
+ * from a. Equal elements are taken from a first, as merge does.
+ */
+int co_rank(int k, const long a[], int m, const long b[], int n) {
+    int lo = k > n ? k - n : 0;
+    int hi = k < m ? k : m;
+    // Find the smallest i such that the element of b just before the split
+    // is smaller than a[i], so the split is in order on both sides
+    while (lo < hi) {
+        int i = lo + (hi - lo) / 2;
+        if (b[k - i - 1] < a[i]) {
+            hi = i;
+        } else {
+            lo = i + 1;
+        }
+    }
+    return lo;
+}
+
+/**
+ * Merge two slices of nums into the corresponding portion of target, in as
+ * many pieces as there are idle workers to take them.
+ */
+void parallel_merge(long nums[], int from, int mid, int to, long target[]) {
+    int pieces = 1 + __atomic_load_n(&idle_count, __ATOMIC_RELAXED);
+    if (pieces > (to - from) / MERGE_CUTOFF) pieces = (to - from) / MERGE_CUTOFF;
+    if (pieces > MERGE_PIECES_MAX) pieces = MERGE_PIECES_MAX;
+    if (pieces <= 1 || self == NULL) {
+        merge(nums, from, mid, to, target);
+        return;
+    }
+
+    SortA tasks[MERGE_PIECES_MAX];
+    int left = from, right = mid;
+    for (int p = 0; p < pieces; p++) {
+        int k = (int)((long)(to - from) * (p + 1) / pieces);
+        int i = co_rank(k, &nums[from], mid - from, &nums[mid], to - mid);
+        tasks[p] = (SortA){.nums = nums, .from = left, .mid = from + i,
+                           .right = right, .to = mid + k - i, .target = target,
+                           .at = left + right - mid, .run = run_merge};
+        left = from + i;
+        right = mid + k - i;
+    }
+    for (int p = 1; p < pieces; p++) {
+        task_spawn(&tasks[p]);
+    }
+    run_task(&tasks[0]);
+    for (int p = pieces - 1; p > 0; p--) {
+        task_sync(&tasks[p]);
+    }
+}
+
+static void run_sort(SortA *task);
+
+/**
+ * Sort the given slice of nums into target, splitting it into tasks for the
+ * pool while it is larger than PARALLEL_CUTOFF.
+ *
+ * Warning: nums gets overwritten.
+ */
+static void parallel_merge_sort_aux(long nums[], int from, int to, long target[]) {
+    if (to - from <= PARALLEL_CUTOFF) {
+        merge_sort_aux(nums, from, to, target);
+        return;
+    }
+
+    int mid = (from + to) / 2;
+    SortA left = {.nums = target, .from = from, .to = mid, .target = nums, .run = run_sort};
+    task_spawn(&left);
+    parallel_merge_sort_aux(target, mid, to, nums);
+    task_sync(&left);
+
+    parallel_merge(nums, from, mid, to, target);
+}
+
+static void run_sort(SortA *task) {
+    parallel_merge_sort_aux(task->nums, task->from, task->to, task->target);
+}
+
+/**
+ * Threaded function of the pool's workers: steal tasks while a sort is
+ * running and sleep otherwise.
  */
 void *threaded_merge_sort(void *args) {
-    SortA *data = (SortA *)args;
-    merge_sort_aux(data->nums, data->from, data->to, data->target);
-    return NULL;
+    self = (Worker *)args;
+    for (;;) {
+        if (__atomic_load_n(&sorting, __ATOMIC_ACQUIRE)) {
+            steal_and_run();
+            continue;
+        }
+        pthread_mutex_lock(&pool_lock);
+        while (!sorting && !stopping) {
+            pthread_cond_wait(&pool_wake, &pool_lock);
+        }
+        int stop = stopping;
+        pthread_mutex_unlock(&pool_lock);
+        if (stop) return NULL;
+    }
+}
+
+/**
+ * Stop and join the pool's threads.
+ */
+static void pool_stop(void) {
+    pthread_mutex_lock(&pool_lock);
+    stopping = 1;
+    pthread_cond_broadcast(&pool_wake);
+    pthread_mutex_unlock(&pool_lock);
+    for (int i = 1; i < worker_count; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    for (int i = 0; i < worker_count; i++) {
+        pthread_mutex_destroy(&workers[i].lock);
+    }
+    free(workers);
+    workers = NULL;
+    worker_count = 0;
+}
+
+/**
+ * Start the pool with thread_count workers, the first of which is the
+ * calling thread. Returns 0 if no threads could be started.
+ */
+static int pool_start(void) {
+    workers = calloc(thread_count, sizeof(Worker));
+    assert(workers != NULL);
+    for (int i = 0; i < thread_count; i++) {
+        pthread_mutex_init(&workers[i].lock, NULL);
+        workers[i].seed = i + 1;
+    }
+    worker_count = 1;
+    for (int i = 1; i < thread_count; i++) {
+        if (pthread_create(&workers[i].thread, NULL, threaded_merge_sort, &workers[i]) != 0) {
+            break;
+        }
+        worker_count++;
+    }
+    self = &workers[0];
+    atexit(pool_stop);
+    return worker_count > 1;
+}
+
+/**
+ * The number of threads asked for with MSORT_THREADS, at least 1.
+ */
+static int threads_from_env(void) {
+    char *threads = getenv("MSORT_THREADS");
+    int count = threads != NULL ? atoi(threads) : 1;
+    return count > 1 ? count : 1;
+}
+
+/**
+ * The leaf size asked for with MSORT_LEAF, LEAF_CUTOFF by default.
+ */
+static int leaf_cutoff_from_env(void) {
+    char *leaf = getenv("MSORT_LEAF");
+    int cutoff = leaf != NULL ? atoi(leaf) : LEAF_CUTOFF;
+    return cutoff > 1 ? cutoff : 1;
+}
+
+/**
+ * Start the pool if MSORT_THREADS asks for one and wake its workers.
+ * Returns 0 if there is no pool to use from this thread.
+ */
+static int pool_begin(void) {
+    if (workers == NULL && threads_from_env() > 1) {
+        thread_count = threads_from_env();
+        pool_start();
+    }
+    if (worker_count <= 1 || self != &workers[0]) return 0;
+
+    pthread_mutex_lock(&pool_lock);
+    __atomic_store_n(&idle_count, worker_count - 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&sorting, 1, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&pool_wake);
+    pthread_mutex_unlock(&pool_lock);
+    return 1;
+}
+
+/**
+ * Let the workers go back to sleep once the sort is done.
+ */
+static void pool_end(void) {
+    pthread_mutex_lock(&pool_lock);
+    __atomic_store_n(&sorting, 0, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&pool_lock);
 }
 
 /**
@@ -124,11 +869,370 @@ long *merge_sort(long nums[], int count) {
 
     memmove(result, nums, count * sizeof(long));
 
-    merge_sort_aux(nums, 0, count, result);
+    if (pool_begin()) {
+        parallel_merge_sort_aux(nums, 0, count, result);
+        pool_end();
+    } else {
+        merge_sort_aux(nums, 0, count, result);
+    }
+
+    return result;
+}
+
+/**
+ * Radix sort.
+ *
+ * An LSD radix sort of RADIX_BITS bits per pass. Keys get their sign bit
+ * flipped so that negative numbers order before positive ones as unsigned
+ * digits. Each pass splits the array into one chunk per worker: every chunk
+ * counts its digits, the counts are turned into each chunk's first output
+ * index per digit, bucket by bucket and chunk by chunk so that the sort stays
+ * stable, and every chunk then scatters its elements. A pass in which all
+ * elements have the same digit is skipped.
+ */
+#define RADIX_BITS 8
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+#define RADIX_CHUNK_MIN (1 << 14)
+
+typedef struct {
+    SortA task;     // first, so that the run functions can cast back
+    int shift;
+    int counts[RADIX_BUCKETS];  // digit counts, then first output indices
+} RadixChunk;
+
+static inline int radix_digit(long value, int shift) {
+    return (((unsigned long)value ^ (1UL << 63)) >> shift) & (RADIX_BUCKETS - 1);
+}
+
+static void run_histogram(SortA *task) {
+    RadixChunk *chunk = (RadixChunk *)task;
+    memset(chunk->counts, 0, sizeof(chunk->counts));
+    for (int i = task->from; i < task->to; i++) {
+        chunk->counts[radix_digit(task->nums[i], chunk->shift)]++;
+    }
+}
+
+static void run_scatter(SortA *task) {
+    RadixChunk *chunk = (RadixChunk *)task;
+    int *next = chunk->counts;
+    for (int i = task->from; i < task->to; i++) {
+        long value = task->nums[i];
+        task->target[next[radix_digit(value, chunk->shift)]++] = value;
+    }
+}
+/**
+ * Run one phase of a pass over all chunks, in parallel if there is a pool.
+ */
+static void radix_phase(RadixChunk chunks[], int count, void (*run)(SortA *task)) {
+    for (int c = 0; c < count; c++) {
+        chunks[c].task.done = 0;
+        chunks[c].task.run = run;
+    }
+    for (int c = 1; c < count; c++) {
+        task_spawn(&chunks[c].task);
+    }
+    run_task(&chunks[0].task);
+    for (int c = count - 1; c > 0; c--) {
+        task_sync(&chunks[c].task);
+    }
+}
+
+/**
+ * Sort the given array with a radix sort and return the sorted version.
+ *
+ * The result is malloc'd so it is the caller's responsibility to free it.
+ *
+ * Warning: The source array gets overwritten.
+ */
+long *radix_sort(long nums[], int count) {
+    long *result = calloc(count, sizeof(long));
+    assert(result != NULL);
+
+    int pool = pool_begin();
+    int chunk_count = pool ? worker_count : 1;
+    if (chunk_count > count / RADIX_CHUNK_MIN) chunk_count = count / RADIX_CHUNK_MIN;
+    if (chunk_count < 1) chunk_count = 1;
+    RadixChunk *chunks = calloc(chunk_count, sizeof(RadixChunk));
+    assert(chunks != NULL);
+
+    long *src = nums, *dst = result;
+    for (int shift = 0; shift < 64; shift += RADIX_BITS) {
+        for (int c = 0; c < chunk_count; c++) {
+            chunks[c].task.from = (int)((long)count * c / chunk_count);
+            chunks[c].task.to = (int)((long)count * (c + 1) / chunk_count);
+            chunks[c].task.nums = src;
+            chunks[c].task.target = dst;
+            chunks[c].shift = shift;
+        }
+        radix_phase(chunks, chunk_count, run_histogram);
+
+        int at = 0, skip = 0;
+        for (int digit = 0; digit < RADIX_BUCKETS; digit++) {
+            int start = at;
+            for (int c = 0; c < chunk_count; c++) {
+                int n = chunks[c].counts[digit];
+                chunks[c].counts[digit] = at;
+                at += n;
+            }
+            skip |= at - start == count;
+        }
+        if (skip) continue;
+
+        radix_phase(chunks, chunk_count, run_scatter);
+        long *sorted = dst;
+        dst = src;
+        src = sorted;
+    }
 
+    if (pool) pool_end();
+    if (src != result) {
+        memcpy(result, src, count * sizeof(long));
+    }
+    free(chunks);
     return result;
 }
 
+/**
+ * Whether MSORT_ALGO asks for the radix sort instead of the merge sort.
+ */
+static int radix_from_env(void) {
+    char *algo = getenv("MSORT_ALGO");
+    return algo != NULL && strcmp(algo, "radix") == 0;
+}
+
+/**
+ * External sort.
+ *
+ * If MSORT_MEM is set and the input needs more memory than that to sort in
+ * RAM, it is sorted in runs. The input is read one run at a time. Each run
+ * is sorted by the pool like a whole array and written to a temporary file
+ * as raw longs. A loser tree then merges the runs, reading each through its
+ * own buffer with an equal share of the memory.
+ *
+ * Runs are kept in levels of up to EXTERNAL_FAN_IN runs. As soon as a level
+ * fills up, its runs are merged into one run of the next level and their
+ * files are closed, so at most EXTERNAL_FAN_IN files per level are open at
+ * a time. The final merge takes the runs left on all levels.
+ *
+ * The limit covers the run being sorted, the merge buffers and the two
+ * IO_BUFFER_SIZE buffers for reading the input and writing the output. A run
+ * holds at least RUN_BUFFER_MIN longs and so does every merge buffer, so the
+ * sort needs about 4 MiB for a merge of EXTERNAL_FAN_IN runs. Below that the
+ * floors win and the limit is exceeded.
+ *
+ * Temporary files go to TMPDIR, /tmp by default, and are unlinked as soon as
+ * they are created.
+ */
+#define EXTERNAL_FAN_IN 64
+#define EXTERNAL_LEVELS 8
+#define RUN_BUFFER_MIN 4096
+
+typedef struct {
+    int fd;
+    long *buf;
+    int pos;
+    int len;        // 0 once the run is exhausted
+    int capacity;
+} Run;
+
+/**
+ * The memory limit in bytes set with MSORT_MEM, which may end in K, M or G.
+ * Returns 0 if there is no limit.
+ */
+static long memory_from_env(void) {
+    char *mem = getenv("MSORT_MEM");
+    if (mem == NULL) return 0;
+    char *suffix;
+    long bytes = strtol(mem, &suffix, 10);
+    switch (*suffix) {
+    case 'G': case 'g': bytes <<= 10; // fall through
+    case 'M': case 'm': bytes <<= 10; // fall through
+    case 'K': case 'k': bytes <<= 10;
+    }
+    return bytes > 0 ? bytes : 0;
+}
+
+/**
+ * Create a temporary file that is already unlinked.
+ */
+static int temp_file(void) {
+    char *dir = getenv("TMPDIR");
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/tmsort-XXXXXX", dir != NULL ? dir : "/tmp");
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        exit(1);
+    }
+    unlink(path);
+    return fd;
+}
+
+static void run_fill(Run *run) {
+    run->pos = 0;
+    run->len = read_binary(run->fd, run->buf, run->capacity);
+}
+
+/**
+ * Whether the head of run a comes before the head of run b. Exhausted runs
+ * come last. Equal heads keep the order of the runs.
+ */
+static int run_before(Run runs[], int a, int b) {
+    if (runs[a].len == 0) return 0;
+    if (runs[b].len == 0) return 1;
+    long x = runs[a].buf[runs[a].pos], y = runs[b].buf[runs[b].pos];
+    return x < y || (x == y && a < b);
+}
+
+/**
+ * Let run leaf play its way up the loser tree again after its head changed.
+ * The tree is an implicit binary tree with the runs as leaves k to 2k - 1.
+ * tree[n] holds the loser of the match at node n. tree[0] holds the overall
+ * winner.
+ */
+static void loser_tree_replay(int tree[], Run runs[], int k, int leaf) {
+    int winner = leaf;
+    for (int n = (leaf + k) / 2; n > 0; n /= 2) {
+        if (run_before(runs, tree[n], winner)) {
+            int loser = winner;
+            winner = tree[n];
+            tree[n] = loser;
+        }
+    }
+    tree[0] = winner;
+}
+
+/**
+ * The buffer size in longs for each of k runs merged in memory bytes.
+ */
+static int run_buffer_size(long memory, int k) {
+    long size = memory / (k * (long)sizeof(long));
+    if (size < RUN_BUFFER_MIN) size = RUN_BUFFER_MIN;
+    return size < IO_BUFFER_SIZE ? size : IO_BUFFER_SIZE;
+}
+
+/**
+ * Merge the sorted runs in fds into out. Each run is read through a buffer
+ * of buffer_size longs. Closes the runs' files.
+ */
+static void merge_runs(int fds[], int k, int buffer_size, Writer *out) {
+    Run *runs = calloc(k, sizeof(Run));
+    int *tree = calloc(k, sizeof(int));
+    int *winners = calloc(2 * k, sizeof(int));
+    assert(runs != NULL && tree != NULL && winners != NULL);
+    for (int i = 0; i < k; i++) {
+        runs[i].fd = fds[i];
+        runs[i].capacity = buffer_size;
+        runs[i].buf = malloc(buffer_size * sizeof(long));
+        assert(runs[i].buf != NULL);
+        lseek(fds[i], 0, SEEK_SET);
+        run_fill(&runs[i]);
+        winners[k + i] = i;
+    }
+    // Play all matches once from the bottom up
+    for (int n = k - 1; n > 0; n--) {
+        int a = winners[2 * n], b = winners[2 * n + 1];
+        int a_wins = run_before(runs, a, b);
+        winners[n] = a_wins ? a : b;
+        tree[n] = a_wins ? b : a;
+    }
+    tree[0] = k > 1 ? winners[1] : 0;
+
+    while (runs[tree[0]].len > 0) {
+        Run *run = &runs[tree[0]];
+        writer_put(out, run->buf[run->pos++]);
+        if (run->pos == run->len) run_fill(run);
+        loser_tree_replay(tree, runs, k, tree[0]);
+    }
+
+    for (int i = 0; i < k; i++) {
+        close(runs[i].fd);
+        free(runs[i].buf);
+    }
+    free(winners);
+    free(tree);
+    free(runs);
+}
+
+/**
+ * Add a sorted run at the given level, merging the level into one run of the
+ * next level once it is full.
+ */
+static void add_run(int fds[][EXTERNAL_FAN_IN], int counts[], int level, int fd,
+                    long budget) {
+    assert(level < EXTERNAL_LEVELS);
+    fds[level][counts[level]++] = fd;
+    if (counts[level] < EXTERNAL_FAN_IN) return;
+
+    Writer writer;
+    int merged = temp_file();
+    writer_init(&writer, merged, 1);
+    merge_runs(fds[level], EXTERNAL_FAN_IN, run_buffer_size(budget, EXTERNAL_FAN_IN),
+               &writer);
+    writer_close(&writer);
+    counts[level] = 0;
+    add_run(fds, counts, level + 1, merged, budget);
+}
+
+/**
+ * Read count numbers from in, sort them in runs that fit in memory bytes
+ * and write the result to out. count may exceed what fits in an int, only
+ * the runs are sorted as arrays. Text or binary I/O follows MSORT_IO. If there
+ * are fewer numbers than count, zeros fill the gap, as in
+ * allocate_load_array.
+ */
+void external_sort(int in, int out, long count, long memory) {
+    int binary = binary_from_env();
+    // The reader and the writer take their buffers off the top
+    long budget = memory - 2 * IO_BUFFER_SIZE;
+    // The sorts need the run and a result array of the same size
+    long run_size = budget / (2 * (long)sizeof(long));
+    if (run_size < RUN_BUFFER_MIN) run_size = RUN_BUFFER_MIN;
+    if (run_size > INT_MAX) run_size = INT_MAX;
+    if (run_size > count) run_size = count > 0 ? count : 1;
+
+    Reader reader;
+    reader_init(&reader, in);
+    int fds[EXTERNAL_LEVELS][EXTERNAL_FAN_IN];
+    int counts[EXTERNAL_LEVELS] = {0};
+    long run_count = 0;
+
+    for (long done = 0; done < count; done += run_size) {
+        int n = count - done < run_size ? count - done : run_size;
+        // Freed before merging a level, so the merge buffers can use the memory
+        long *array = calloc(n, sizeof(long));
+        assert(array != NULL);
+        if (binary) {
+            read_binary(in, array, n);
+        } else {
+            reader_longs(&reader, array, n);
+        }
+        long *sorted = radix_from_env() ? radix_sort(array, n) : merge_sort(array, n);
+        free(array);
+        int fd = temp_file();
+        write_all(fd, (const char *)sorted, n * sizeof(long));
+        free(sorted);
+        add_run(fds, counts, 0, fd, budget);
+        run_count++;
+    }
+    free(reader.buf);
+    log("Sorted %ld runs of up to %ld elements.\n", run_count, run_size);
+
+    int left[EXTERNAL_LEVELS * EXTERNAL_FAN_IN];
+    int k = 0;
+    for (int level = 0; level < EXTERNAL_LEVELS; level++) {
+        for (int i = 0; i < counts[level]; i++) {
+            left[k++] = fds[level][i];
+        }
+    }
+    Writer writer;
+    writer_init(&writer, out, binary);
+    if (k > 0) {
+        merge_runs(left, k, run_buffer_size(budget, k), &writer);
+    }
+    writer_close(&writer);
+}
+
 /**
  * Based on command line arguments, allocate and populate an input and a helper array.
  *
@@ -141,16 +1245,32 @@ int allocate_load_array(int argc, char **argv, long **array) {
     *array = calloc(count, sizeof(long));
     assert(*array != NULL);
 
-    long element;
-    tty_printf("Enter %d elements, separated by whitespace\n", count);
-    int i = 0;
-    while (i < count && scanf("%ld", &element) != EOF) {
-        (*array)[i++] = element;
+    if (binary_from_env()) {
+        read_binary(0, *array, count);
+    } else {
+        tty_printf("Enter %d elements, separated by whitespace\n", count);
+        fflush(stdout);
+        read_longs(0, *array, count);
     }
 
     return count;
 }
 
+/**
+ * Parse the number of elements given on the command line. Returns -1 unless
+ * arg is a whole number from 0 to LONG_MAX.
+ */
+static long count_from_arg(const char *arg) {
+    char *end;
+    errno = 0;
+    long long count = strtoll(arg, &end, 10);
+    if (errno != 0 || end == arg || *end != '\0' || count < 0 || count > LONG_MAX) {
+        return -1;
+    }
+    return count;
+}
+
+#ifndef TMSORT_TEST
 /**
  * Main function to execute threaded merge sort.
  */
@@ -160,25 +1280,49 @@ int main(int argc, char **argv) {
         return 1;
     }
 
+    long count = count_from_arg(argv[1]);
+    if (count < 0) {
+        fprintf(stderr, "%s: invalid number of elements: %s\n", argv[0], argv[1]);
+        return 1;
+    }
+
     struct timeval begin, end;
 
-    // Get the number of threads from the environment variable SORT_THREADS
-    if (getenv("MSORT_THREADS") != NULL)
-        thread_count = atoi(getenv("MSORT_THREADS"));
+    // Get the number of threads from the environment variable MSORT_THREADS
+    thread_count = threads_from_env();
+    leaf_cutoff = leaf_cutoff_from_env();
+
+    // Sort from and to disk if MSORT_MEM is too small to sort in memory
+    long memory = memory_from_env();
+    if (memory > 0 && count > memory / (2 * (long)sizeof(long))) {
+        log("Running with %d thread(s) and %ld bytes of memory, sorting externally.\n",
+            thread_count, memory);
+        gettimeofday(&begin, 0);
+        external_sort(0, 1, count, memory);
+        gettimeofday(&end, 0);
+        log("External sort completed in %f seconds.\n", time_in_secs(&begin, &end));
+        return 0;
+    }
+
+    if (count > INT_MAX) {
+        fprintf(stderr, "%s: %ld elements do not fit in memory, set MSORT_MEM to sort "
+                "them externally\n", argv[0], count);
+        return 1;
+    }
 
     log("Running with %d thread(s). Reading input.\n", thread_count);
 
     // Read the input
     gettimeofday(&begin, 0);
     long *array = NULL;
-    int count = allocate_load_array(argc, argv, &array);
+    allocate_load_array(argc, argv, &array);
     gettimeofday(&end, 0);
 
     log("Array read in %f seconds, beginning sort.\n", time_in_secs(&begin, &end));
 
     // Sort the array
     gettimeofday(&begin, 0);
-    long *result = merge_sort(array, count);
+    long *result = radix_from_env() ? radix_sort(array, count) : merge_sort(array, count);
     gettimeofday(&end, 0);
 
     log("Sorting completed in %f seconds.\n", time_in_secs(&begin, &end));
@@ -195,3 +1339,4 @@ int main(int argc, char **argv) {
 
     return 0;
 }
+#endif
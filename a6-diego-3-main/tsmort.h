@@ -6,5 +6,6 @@
 // Declaring the functions for testing and so they can be used in tmsort.c
 void *threaded_merge_sort(void *args);
 long *merge_sort(long nums[], int count);
+long *radix_sort(long nums[], int count);
 
 #endif 
@@ -0,0 +1,77 @@
+// False sharing between threads
+// each thread increments a counter of its own, allocated one after the other
+// so that without padding several counters share a cache line
+
+#ifndef DEMO_TEST
+#include <malloc.h>
+#else
+#include <stdlib.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#define THREADS 4
+#define INCREMENTS 50000000
+
+static void *worker(void *arg) {
+  volatile long *counter = (volatile long *) arg;
+  for (int i = 0; i < INCREMENTS; i++) {
+    (*counter)++;
+  }
+  return NULL;
+}
+
+static void run(const char *mode) {
+  volatile long *counters[THREADS];
+  for (int t = 0; t < THREADS; t++) {
+    counters[t] = (volatile long *) malloc(sizeof(long));
+    *counters[t] = 0;
+  }
+
+  pthread_t threads[THREADS];
+  struct timespec begin, end;
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+  for (int t = 0; t < THREADS; t++) {
+    pthread_create(&threads[t], NULL, worker, (void *) counters[t]);
+  }
+  for (int t = 0; t < THREADS; t++) {
+    pthread_join(threads[t], NULL);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  double secs = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) * 1e-9;
+  printf("%-12s counters %zu bytes apart: %7.2f M increments/s\n", mode,
+         (size_t) ((char *) counters[1] - (char *) counters[0]),
+         THREADS * (double) INCREMENTS / secs / 1e6);
+  for (int t = 0; t < THREADS; t++) {
+    free((void *) counters[t]);
+  }
+}
+
+int main() {
+  fprintf(stderr,
+      "=======================================================================\n"
+      "%d threads increment counters allocated back to back, once packed and\n"
+      "once with MYMALLOC_CACHELINE=1. On more than one core the padded\n"
+      "counters should be much faster, as their cache lines are not shared.\n"
+      "=======================================================================\n",
+      THREADS);
+
+  // The allocator reads the environment once, so each mode gets a process
+  const char *modes[] = { "packed", "cache line" };
+  for (int m = 0; m < 2; m++) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      setenv("MYMALLOC_CACHELINE", m ? "1" : "0", 1);
+      run(modes[m]);
+      exit(0);
+    }
+    waitpid(pid, NULL, 0);
+  }
+  return 0;
+}
@@ -0,0 +1,79 @@
+// Free latency against heap size
+// fills the heap with a growing number of live objects and times freeing
+// and reallocating a random sample of them, which should stay flat
+
+#ifndef DEMO_TEST
+#include <malloc.h>
+#else
+#include <stdlib.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define MAX_LIVE 1000000
+#define SAMPLE 100000
+
+static void *live[MAX_LIVE];
+static int victims[SAMPLE];
+
+static double elapsed(const struct timespec *begin, const struct timespec *end) {
+  return (end->tv_sec - begin->tv_sec) + (end->tv_nsec - begin->tv_nsec) * 1e-9;
+}
+
+static size_t random_size(unsigned int *seed) {
+  // mostly small objects, with some above the thread cache limit
+  return 16 + rand_r(seed) % (rand_r(seed) % 4 ? 512 : 4096);
+}
+
+int main() {
+  fprintf(stderr,
+      "=======================================================================\n"
+      "Free latency with 1k to 1M live objects. %d random objects are freed\n"
+      "and then allocated again; ns per free should not grow with the number of\n"
+      "free blocks, only with cache misses (compare a -DDEMO_TEST build).\n"
+      "=======================================================================\n",
+      SAMPLE);
+
+  unsigned int seed = 42;
+  int count = 0;
+
+  for (int target = 1000; target <= MAX_LIVE; target *= 10) {
+    while (count < target) {
+      live[count++] = malloc(random_size(&seed));
+    }
+
+    int sample = count < SAMPLE ? count : SAMPLE;
+    for (int i = 0; i < sample; i++) {
+      victims[i] = rand_r(&seed) % count;
+    }
+
+    struct timespec begin, end;
+    int freed = 0;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    for (int i = 0; i < sample; i++) {
+      // an object picked twice is only freed once
+      if (live[victims[i]]) {
+        free(live[victims[i]]);
+        live[victims[i]] = NULL;
+        freed++;
+      }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double free_ns = elapsed(&begin, &end) * 1e9 / freed;
+
+    for (int i = 0; i < sample; i++) {
+      if (!live[victims[i]]) {
+        live[victims[i]] = malloc(random_size(&seed));
+      }
+    }
+
+    printf("%8d live objects: %7.1f ns per free\n", count, free_ns);
+  }
+
+  for (int i = 0; i < count; i++) {
+    free(live[i]);
+  }
+  return 0;
+}
@@ -0,0 +1,63 @@
+// Hardened mode overhead
+// the allocation pattern of bench_threads in one thread, once normally and
+// once with MYMALLOC_HARDENED=1
+
+#include <malloc.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#define SLOTS 256
+#define OPS 20000000
+
+static void run(const char *mode) {
+  unsigned int seed = 1;
+  char *slots[SLOTS] = { NULL };
+  struct timespec begin, end;
+
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+  for (int i = 0; i < OPS; i++) {
+    int k = rand_r(&seed) % SLOTS;
+    if (slots[k]) {
+      free(slots[k]);
+      slots[k] = NULL;
+    } else {
+      size_t size = 8 + rand_r(&seed) % 512;
+      slots[k] = (char *) malloc(size);
+      slots[k][0] = (char) k;
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  for (int k = 0; k < SLOTS; k++) {
+    free(slots[k]);
+  }
+  double secs = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) * 1e-9;
+  printf("%-10s %7.2f Mops/s\n", mode, OPS / secs / 1e6);
+}
+
+int main() {
+  fprintf(stderr,
+      "=======================================================================\n"
+      "%d random mallocs and frees of 8 to 519 bytes, with and without\n"
+      "MYMALLOC_HARDENED. The checks and quarantine should cost less than\n"
+      "half of the throughput.\n"
+      "=======================================================================\n",
+      OPS);
+
+  // The allocator reads the environment once, so each mode gets a process
+  const char *modes[] = { "normal", "hardened" };
+  for (int m = 0; m < 2; m++) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      setenv("MYMALLOC_HARDENED", m ? "1" : "0", 1);
+      run(modes[m]);
+      exit(0);
+    }
+    waitpid(pid, NULL, 0);
+  }
+  return 0;
+}
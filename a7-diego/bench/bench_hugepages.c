@@ -0,0 +1,100 @@
+// Huge page throughput
+// a large working set of small blocks is visited in random order, once with
+// normal pages and once with MYMALLOC_HUGEPAGES=1
+
+#include <malloc.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#define BLOCKS (4 * 1024 * 1024)
+#define BLOCK_BYTES 224
+#define VISITS 20000000
+
+typedef struct node {
+  struct node *next;
+  char data[BLOCK_BYTES - sizeof(struct node *)];
+} node_t;
+
+// Bytes of the process backed by transparent huge pages
+static size_t anon_huge_bytes(void) {
+  FILE *f = fopen("/proc/self/smaps_rollup", "r");
+  if (!f) {
+    return 0;
+  }
+  char line[256];
+  size_t kb = 0;
+  while (fgets(line, sizeof(line), f)) {
+    if (sscanf(line, "AnonHugePages: %zu kB", &kb) == 1) {
+      break;
+    }
+  }
+  fclose(f);
+  return kb * 1024;
+}
+
+static void run(const char *mode) {
+  node_t **nodes = (node_t **) malloc(BLOCKS * sizeof(node_t *));
+  for (size_t i = 0; i < BLOCKS; i++) {
+    nodes[i] = (node_t *) malloc(sizeof(node_t));
+    memset(nodes[i], 0, sizeof(node_t));
+  }
+
+  // Link the blocks into one cycle in random order
+  unsigned int seed = 1;
+  for (size_t i = BLOCKS - 1; i > 0; i--) {
+    size_t j = rand_r(&seed) % (i + 1);
+    node_t *tmp = nodes[i];
+    nodes[i] = nodes[j];
+    nodes[j] = tmp;
+  }
+  for (size_t i = 0; i < BLOCKS; i++) {
+    nodes[i]->next = nodes[(i + 1) % BLOCKS];
+  }
+
+  struct timespec begin, end;
+  node_t *node = nodes[0];
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+  for (int i = 0; i < VISITS; i++) {
+    node->data[0]++;
+    node = node->next;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  double secs = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) * 1e-9;
+  printf("%-10s %6.1f ns per visit, %5.2f M visits/s, %zu MiB in huge pages\n",
+         mode, secs * 1e9 / VISITS, VISITS / secs / 1e6,
+         anon_huge_bytes() >> 20);
+
+  for (size_t i = 0; i < BLOCKS; i++) {
+    free(nodes[i]);
+  }
+  free(nodes);
+}
+
+int main() {
+  fprintf(stderr,
+      "=======================================================================\n"
+      "%d blocks of %d bytes (about %d MiB) are visited %d times in random\n"
+      "order, with normal pages and with MYMALLOC_HUGEPAGES=1. Huge pages\n"
+      "should make each visit cheaper, as far fewer TLB misses are taken.\n"
+      "=======================================================================\n",
+      BLOCKS, BLOCK_BYTES, (int) ((size_t) BLOCKS * BLOCK_BYTES >> 20), VISITS);
+
+  // The allocator reads the environment once, so each mode gets a process
+  const char *modes[] = { "normal", "huge pages" };
+  for (int m = 0; m < 2; m++) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      setenv("MYMALLOC_HUGEPAGES", m ? "1" : "0", 1);
+      run(modes[m]);
+      exit(0);
+    }
+    waitpid(pid, NULL, 0);
+  }
+  return 0;
+}
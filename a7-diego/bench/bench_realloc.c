@@ -0,0 +1,70 @@
+// Amortized vector growth
+// pushes 10M elements onto a vector that grows with realloc like vect_add in
+// a4, once doubling the capacity and once growing it by a fixed step
+
+#ifndef DEMO_TEST
+#include <malloc.h>
+#else
+#include <stdlib.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define ELEMENTS 10000000
+#define STEP 4096
+
+typedef struct {
+  long *data;
+  size_t size;
+  size_t capacity;
+  size_t moves;
+} vector_t;
+
+static void push(vector_t *v, long elt, int doubling) {
+  if (v->size == v->capacity) {
+    size_t new_capacity = doubling ? v->capacity * 2 : v->capacity + STEP;
+    long *new_data = (long *) realloc(v->data, new_capacity * sizeof(long));
+    if (!new_data) {
+      perror("realloc");
+      exit(1);
+    }
+    v->moves += (new_data != v->data);
+    v->data = new_data;
+    v->capacity = new_capacity;
+  }
+  v->data[v->size++] = elt;
+}
+
+static void run(const char *name, int doubling) {
+  vector_t v = { NULL, 0, 0, 0 };
+  v.capacity = 16;
+  v.data = (long *) malloc(v.capacity * sizeof(long));
+
+  struct timespec begin, end;
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+  for (long i = 0; i < ELEMENTS; i++) {
+    push(&v, i, doubling);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  double secs = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) * 1e-9;
+  printf("%-14s %7.2f ns per push, %6zu moves\n",
+         name, secs * 1e9 / ELEMENTS, v.moves);
+  free(v.data);
+}
+
+int main() {
+  fprintf(stderr,
+      "=======================================================================\n"
+      "Pushes %d elements onto a vector grown with realloc. Growing in place\n"
+      "and mremap should keep the moves (copies) rare even with a fixed\n"
+      "growth step (compare a -DDEMO_TEST build).\n"
+      "=======================================================================\n",
+      ELEMENTS);
+
+  run("doubling", 1);
+  run("fixed step", 0);
+  return 0;
+}
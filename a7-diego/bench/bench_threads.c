@@ -0,0 +1,84 @@
+// Multi-threaded allocation throughput
+// every thread keeps a small working set of live blocks and randomly
+// replaces them, so most requests can be served from recently freed memory
+
+#ifndef DEMO_TEST
+#include <malloc.h>
+#else
+#include <stdlib.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#define MAX_THREADS 16
+#define SLOTS 256
+#define OPS_PER_THREAD 2000000
+
+static void *worker(void *arg) {
+  unsigned int seed = (unsigned int) (size_t) arg;
+  char *slots[SLOTS] = { NULL };
+
+  for (int i = 0; i < OPS_PER_THREAD; i++) {
+    int k = rand_r(&seed) % SLOTS;
+    if (slots[k]) {
+      free(slots[k]);
+      slots[k] = NULL;
+    } else {
+      size_t size = 8 + rand_r(&seed) % 512;
+      slots[k] = (char *) malloc(size);
+      slots[k][0] = (char) k;
+    }
+  }
+
+  for (int k = 0; k < SLOTS; k++) {
+    free(slots[k]);
+  }
+  return NULL;
+}
+
+static double run(int nthreads) {
+  pthread_t threads[MAX_THREADS];
+  struct timespec begin, end;
+
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+  for (int t = 0; t < nthreads; t++) {
+    pthread_create(&threads[t], NULL, worker, (void *) (size_t) (t + 1));
+  }
+  for (int t = 0; t < nthreads; t++) {
+    pthread_join(threads[t], NULL);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  return (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) * 1e-9;
+}
+
+int main(int argc, char **argv) {
+  int max_threads = argc > 1 ? atoi(argv[1]) : 8;
+  if (max_threads > MAX_THREADS) {
+    max_threads = MAX_THREADS;
+  }
+
+  fprintf(stderr,
+      "=======================================================================\n"
+      "Allocation throughput with 1 to %d threads, %d malloc/free operations\n"
+      "per thread. Throughput should grow with the thread count up to the\n"
+      "number of cores.\n"
+      "=======================================================================\n",
+      max_threads, OPS_PER_THREAD);
+
+  double base = 0;
+  for (int n = 1; n <= max_threads; n *= 2) {
+    double secs = run(n);
+    double ops = (double) n * OPS_PER_THREAD / secs;
+    if (n == 1) {
+      base = ops;
+    }
+    printf("%2d threads: %8.2f Mops/s (%.2fx)\n", n, ops / 1e6, ops / base);
+  }
+
+  return 0;
+}
@@ -0,0 +1,421 @@
+// Allocation trace replay
+// replays a trace recorded with MYMALLOC_TRACE against the allocator this
+// file is built with: mymalloc, glibc (-DDEMO_TEST), mymalloc with slab
+// caches for small objects (-DREPLAY_SLAB) or the a5 allocator
+
+#ifndef DEMO_TEST
+#include <malloc.h>
+#else
+#include <stdlib.h>
+#endif
+
+#ifdef REPLAY_SLAB
+#include "slab.h"
+#endif
+
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#if defined(REPLAY_SLAB)
+#define ALLOCATOR "slab"
+#elif defined(DEMO_TEST)
+#define ALLOCATOR "glibc"
+#elif defined(realloc)
+#define ALLOCATOR "mymalloc"
+#else
+#define ALLOCATOR "a5"
+#endif
+
+#define LATENCY_BUCKETS 65536   // 1 ns each, slower calls go in the last one
+
+typedef struct {
+  uint32_t op;
+  uint32_t id;      // allocation the operation works on
+  uint64_t size;
+} op_t;
+
+typedef struct {
+  op_t *ops;
+  size_t count;
+  size_t ids;
+} replay_t;
+
+// The replay's own memory comes from mmap so it does not show up in the
+// allocator under test
+static void *map(size_t size) {
+  void *p = mmap(NULL, size ? size : 1, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) {
+    perror("mmap");
+    exit(1);
+  }
+  return p;
+}
+
+/*
+ * Address to allocation id table, open addressing with linear probing.
+ * Freed entries become tombstones; the table holds one entry per record at
+ * most, so it never fills up.
+ */
+#define EMPTY 0
+#define TOMBSTONE 1
+
+typedef struct {
+  uint64_t *keys;
+  uint32_t *values;
+  size_t mask;
+} table_t;
+
+static size_t slot(const table_t *t, uint64_t key) {
+  return (key * 0x9e3779b97f4a7c15UL >> 17) & t->mask;
+}
+
+static int64_t table_remove(table_t *t, uint64_t key) {
+  for (size_t i = slot(t, key); t->keys[i] != EMPTY; i = (i + 1) & t->mask) {
+    if (t->keys[i] == key) {
+      t->keys[i] = TOMBSTONE;
+      return t->values[i];
+    }
+  }
+  return -1;
+}
+
+static void table_insert(table_t *t, uint64_t key, uint32_t value) {
+  size_t i = slot(t, key);
+  while (t->keys[i] > TOMBSTONE) {
+    i = (i + 1) & t->mask;
+  }
+  t->keys[i] = key;
+  t->values[i] = value;
+}
+
+/*
+ * Map a returned address to an allocation id. An address still in the table
+ * was freed in a race with the call that returned it again, so the
+ * allocation it belonged to gets an implicit free first.
+ */
+static void track(table_t *t, replay_t *r, uint64_t key, uint32_t id) {
+  int64_t old = table_remove(t, key);
+  if (old >= 0) {
+    r->ops[r->count++] = (op_t) { TRACE_FREE, (uint32_t) old, 0 };
+  }
+  table_insert(t, key, id);
+}
+
+/*
+ * Read a trace and turn addresses into allocation ids. Frees of memory
+ * allocated before the trace started are dropped.
+ */
+static replay_t load(const char *path) {
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    perror(path);
+    exit(1);
+  }
+  size_t count = st.st_size >= 8 ? (st.st_size - 8) / sizeof(trace_record_t) : 0;
+  char *data = mmap(NULL, st.st_size ? st.st_size : 1, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED || st.st_size < 8 || memcmp(data, TRACE_MAGIC, 8) != 0) {
+    fprintf(stderr, "%s: not an allocation trace\n", path);
+    exit(1);
+  }
+  close(fd);
+  const trace_record_t *records = (const trace_record_t *) (data + 8);
+
+  table_t table;
+  size_t capacity = 16;
+  while (capacity < 2 * count) {
+    capacity *= 2;
+  }
+  table.keys = map(capacity * sizeof(uint64_t));
+  table.values = map(capacity * sizeof(uint32_t));
+  table.mask = capacity - 1;
+
+  // a reused address can need an implicit free, so up to twice the records
+  replay_t r = { map(2 * count * sizeof(op_t)), 0, 0 };
+  for (size_t i = 0; i < count; i++) {
+    const trace_record_t *rec = &records[i];
+    int64_t id;
+    switch (rec->op) {
+    case TRACE_MALLOC:
+      track(&table, &r, rec->result, r.ids);
+      r.ops[r.count++] = (op_t) { TRACE_MALLOC, (uint32_t) r.ids++, rec->size };
+      break;
+    case TRACE_FREE:
+      if ((id = table_remove(&table, rec->ptr)) >= 0) {
+        r.ops[r.count++] = (op_t) { TRACE_FREE, (uint32_t) id, 0 };
+      }
+      break;
+    case TRACE_REALLOC:
+      if ((id = table_remove(&table, rec->ptr)) < 0) {
+        // allocated before the trace started, replay it as a malloc
+        track(&table, &r, rec->result, r.ids);
+        r.ops[r.count++] = (op_t) { TRACE_MALLOC, (uint32_t) r.ids++, rec->size };
+        break;
+      }
+      track(&table, &r, rec->result, (uint32_t) id);
+      r.ops[r.count++] = (op_t) { TRACE_REALLOC, (uint32_t) id, rec->size };
+      break;
+    default:
+      fprintf(stderr, "%s: bad record %zu\n", path, i);
+      exit(1);
+    }
+  }
+
+  munmap(data, st.st_size);
+  munmap(table.keys, capacity * sizeof(uint64_t));
+  munmap(table.values, capacity * sizeof(uint32_t));
+  return r;
+}
+
+#ifdef REPLAY_SLAB
+// one cache per 16-byte class up to SLAB_OBJECT_MAX, larger sizes use malloc
+static slab_cache_t *caches[SLAB_OBJECT_MAX / 16];
+
+static slab_cache_t *cache_for(size_t size) {
+  if (size == 0 || size > SLAB_OBJECT_MAX) {
+    return NULL;
+  }
+  size_t idx = (size - 1) / 16;
+  if (!caches[idx]) {
+    caches[idx] = slab_create((idx + 1) * 16);
+  }
+  return caches[idx];
+}
+
+static void *replay_malloc(size_t size) {
+  slab_cache_t *cache = cache_for(size);
+  return cache ? slab_alloc(cache) : malloc(size);
+}
+
+static void replay_free(void *ptr, size_t size) {
+  slab_cache_t *cache = cache_for(size);
+  if (cache) {
+    slab_free(cache, ptr);
+  } else {
+    free(ptr);
+  }
+}
+
+static void *replay_realloc(void *ptr, size_t old_size, size_t size) {
+  slab_cache_t *old_cache = cache_for(old_size);
+  if (!old_cache && !cache_for(size)) {
+    return realloc(ptr, size);
+  }
+  if (old_cache && old_cache == cache_for(size)) {
+    return ptr;
+  }
+  void *new_ptr = replay_malloc(size);
+  memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+  replay_free(ptr, old_size);
+  return new_ptr;
+}
+#else
+static void *replay_malloc(size_t size) {
+  return malloc(size);
+}
+
+static void replay_free(void *ptr, size_t size) {
+  (void) size;
+  free(ptr);
+}
+
+static void *replay_realloc(void *ptr, size_t old_size, size_t size) {
+#if defined(realloc) || defined(DEMO_TEST)
+  (void) old_size;
+  return realloc(ptr, size);
+#else
+  // the a5 allocator has no realloc
+  void *new_ptr = malloc(size);
+  memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+  free(ptr);
+  return new_ptr;
+#endif
+}
+#endif
+
+// Write to every page of a new allocation, as the program it came from would
+static void touch(char *p, size_t size) {
+  for (size_t i = 0; i < size; i += 4096) {
+    p[i] = 1;
+  }
+}
+
+// Shortest time between two clock readings, taken off every latency
+static uint64_t timer_overhead(void) {
+  uint64_t best = UINT64_MAX;
+  for (int i = 0; i < 1000; i++) {
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    uint64_t ns = (t1.tv_sec - t0.tv_sec) * 1000000000UL + t1.tv_nsec - t0.tv_nsec;
+    if (ns < best) {
+      best = ns;
+    }
+  }
+  return best;
+}
+
+static double now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/*
+ * A field of /proc/self/status in bytes, such as "VmRSS:" or "VmHWM:".
+ * Read without stdio, whose buffers would come from glibc's heap and be
+ * counted before the replay.
+ */
+static size_t status_bytes(const char *field) {
+  char buf[4096];
+  int fd = open("/proc/self/status", O_RDONLY);
+  if (fd < 0) {
+    return 0;
+  }
+  ssize_t n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  buf[n > 0 ? n : 0] = '\0';
+  char *line = strstr(buf, field);
+  return line ? strtoul(line + strlen(field), NULL, 10) * 1024 : 0;
+}
+
+// Start VmHWM over from the current RSS
+static void reset_peak_rss(void) {
+  int fd = open("/proc/self/clear_refs", O_WRONLY);
+  if (fd >= 0) {
+    if (write(fd, "5", 1) != 1) {
+      perror("clear_refs");
+    }
+    close(fd);
+  }
+}
+
+/*
+ * Replay all operations. With latencies, every call is timed and counted in
+ * its 1 ns bucket. Returns the seconds the replay took.
+ */
+static double run(const replay_t *r, char **ptrs, uint64_t *sizes,
+                  uint64_t *latencies, size_t *peak_live) {
+  size_t live = 0;
+  uint64_t overhead = latencies ? timer_overhead() : 0;
+  double begin = now();
+  for (size_t i = 0; i < r->count; i++) {
+    const op_t *op = &r->ops[i];
+    struct timespec t0, t1;
+    if (latencies) {
+      clock_gettime(CLOCK_MONOTONIC, &t0);
+    }
+    switch (op->op) {
+    case TRACE_MALLOC:
+      ptrs[op->id] = replay_malloc(op->size);
+      break;
+    case TRACE_FREE:
+      replay_free(ptrs[op->id], sizes[op->id]);
+      break;
+    case TRACE_REALLOC:
+      ptrs[op->id] = replay_realloc(ptrs[op->id], sizes[op->id], op->size);
+      break;
+    }
+    if (latencies) {
+      clock_gettime(CLOCK_MONOTONIC, &t1);
+      uint64_t ns = (t1.tv_sec - t0.tv_sec) * 1000000000UL + t1.tv_nsec - t0.tv_nsec;
+      ns = ns > overhead ? ns - overhead : 0;
+      latencies[ns < LATENCY_BUCKETS ? ns : LATENCY_BUCKETS - 1]++;
+    }
+
+    if (op->op == TRACE_FREE) {
+      live -= sizes[op->id];
+      sizes[op->id] = 0;
+      continue;
+    }
+    if (!ptrs[op->id] && op->size) {
+      fprintf(stderr, "%s: out of memory at operation %zu\n", ALLOCATOR, i);
+      exit(1);
+    }
+    live += op->size - sizes[op->id];
+    if (op->size > sizes[op->id]) {
+      touch(ptrs[op->id] + sizes[op->id], op->size - sizes[op->id]);
+    }
+    sizes[op->id] = op->size;
+    if (live > *peak_live) {
+      *peak_live = live;
+    }
+  }
+  return now() - begin;
+}
+
+static uint64_t percentile(const uint64_t *latencies, size_t count, double p) {
+  uint64_t target = (uint64_t) (count * p);
+  uint64_t seen = 0;
+  for (size_t ns = 0; ns < LATENCY_BUCKETS; ns++) {
+    seen += latencies[ns];
+    if (seen > target) {
+      return ns;
+    }
+  }
+  return LATENCY_BUCKETS;
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s trace\n", argv[0]);
+    return 2;
+  }
+  replay_t r = load(argv[1]);
+
+  // Each pass runs in a fresh process, so it starts from an empty heap
+  for (int timed = 0; timed < 2; timed++) {
+    pid_t pid = fork();
+    if (pid != 0) {
+      waitpid(pid, NULL, 0);
+      continue;
+    }
+
+    char **ptrs = map(r.ids * sizeof(char *));
+    uint64_t *sizes = map(r.ids * sizeof(uint64_t));
+    uint64_t *latencies = timed ? map(LATENCY_BUCKETS * sizeof(uint64_t)) : NULL;
+    memset(ptrs, 0, r.ids * sizeof(char *));
+    memset(sizes, 0, r.ids * sizeof(uint64_t));
+    if (latencies) {
+      memset(latencies, 0, LATENCY_BUCKETS * sizeof(uint64_t));
+    }
+    // Peak and baseline are both measured from here, with the ops read once
+    // so that they count in both
+    volatile uint64_t total = 0;
+    for (size_t i = 0; i < r.count; i++) {
+      total += r.ops[i].size;
+    }
+    reset_peak_rss();
+    size_t base_rss = status_bytes("VmRSS:");
+    size_t peak_live = 0;
+    double secs = run(&r, ptrs, sizes, latencies, &peak_live);
+
+    if (!timed) {
+      size_t peak_rss = status_bytes("VmHWM:");
+      size_t used = peak_rss > base_rss ? peak_rss - base_rss : 0;
+      printf("%-9s %9zu ops %8.2f Mops/s  peak RSS %8zu KiB  peak live %8zu KiB"
+             "  overhead %6.1f%%\n", ALLOCATOR, r.count, r.count / secs / 1e6,
+             used / 1024, peak_live / 1024,
+             peak_live ? 100.0 * ((double) used / peak_live - 1) : 0.0);
+    } else {
+      printf("%-9s latency p50 %5lu ns  p99 %5lu ns  p99.9 %6lu ns\n", ALLOCATOR,
+             percentile(latencies, r.count, 0.5),
+             percentile(latencies, r.count, 0.99),
+             percentile(latencies, r.count, 0.999));
+    }
+    fflush(stdout);
+    _exit(0);
+  }
+  return 0;
+}
@@ -0,0 +1,68 @@
+// Wall time and peak RSS of a command
+// runs the command once with the system allocator and once with
+// LD_PRELOAD=./libmymalloc.so so both can be compared on unmodified programs
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+static int run(char **argv, const char *preload, double *secs, long *max_rss) {
+  struct timespec begin, end;
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    if (preload) {
+      setenv("LD_PRELOAD", preload, 1);
+    }
+    execvp(argv[0], argv);
+    perror(argv[0]);
+    _exit(127);
+  }
+
+  int status;
+  struct rusage usage;
+  if (pid < 0 || wait4(pid, &status, 0, &usage) < 0) {
+    perror("runstat");
+    return -1;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  *secs = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) * 1e-9;
+  *max_rss = usage.ru_maxrss;
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s command [args...]\n", argv[0]);
+    return 2;
+  }
+
+  char library[PATH_MAX];
+  if (!realpath("libmymalloc.so", library)) {
+    perror("libmymalloc.so");
+    return 2;
+  }
+
+  double secs[2];
+  long max_rss[2];
+  const char *names[2] = { "glibc", "mymalloc" };
+  for (int i = 0; i < 2; i++) {
+    int status = run(argv + 1, i ? library : NULL, &secs[i], &max_rss[i]);
+    if (status != 0) {
+      fprintf(stderr, "%s run exited with status %d\n", names[i], status);
+      return 1;
+    }
+  }
+
+  for (int i = 0; i < 2; i++) {
+    fprintf(stderr, "%-9s %8.3f s %10ld KiB peak RSS\n",
+            names[i], secs[i], max_rss[i]);
+  }
+  return 0;
+}
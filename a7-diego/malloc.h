@@ -10,10 +10,50 @@
 
 #define malloc(size) mymalloc(size)
 #define calloc(nmemb, size) mycalloc(nmemb, size)
+#define realloc(ptr, size) myrealloc(ptr, size)
 #define free(ptr) myfree(ptr)
 
 void *mymalloc(size_t size);
 void *mycalloc(size_t nmemb, size_t size);
+void *myrealloc(void *ptr, size_t size);
+void *mymemalign(size_t alignment, size_t size);
+size_t mymalloc_usable_size(void *ptr);
 void myfree(void *ptr);
 
+/* Statistics about the allocator's memory, see mymalloc_stats */
+#define MYMALLOC_SIZE_CLASSES 118
+#define MYMALLOC_ARENAS_MAX 64
+
+typedef struct mymalloc_stats {
+  size_t free_blocks;             /* number of blocks in the free lists */
+  size_t free_bytes;              /* total payload bytes in the free lists */
+  size_t largest_free;            /* payload size of the largest free block */
+  size_t cached_blocks;           /* free blocks held in thread caches */
+  size_t requested_bytes;         /* bytes asked for by live allocations */
+  size_t reserved_bytes;          /* bytes held by them, headers included */
+  double external_fragmentation;  /* 1 - largest_free / free_bytes */
+  double internal_fragmentation;  /* 1 - requested_bytes / reserved_bytes */
+  size_t mapped_bytes;            /* bytes currently mapped by the allocator */
+  size_t peak_mapped_bytes;       /* highest value of mapped_bytes so far */
+  size_t peak_rss;                /* peak resident set size of the process */
+  size_t lock_contention;         /* times a thread found a lock held */
+  /* Allocations and frees per size class, a realloc counting as one of
+   * each. class_size is the smallest block size of the class. */
+  size_t class_size[MYMALLOC_SIZE_CLASSES];
+  size_t allocs[MYMALLOC_SIZE_CLASSES];
+  size_t frees[MYMALLOC_SIZE_CLASSES];
+  /* Per arena: bytes mapped for its regions, free payload bytes in its
+   * bins, and times its lock was found held. */
+  size_t arenas;                  /* number of arenas in use */
+  size_t arena_mapped[MYMALLOC_ARENAS_MAX];
+  size_t arena_free[MYMALLOC_ARENAS_MAX];
+  size_t arena_contention[MYMALLOC_ARENAS_MAX];
+} mymalloc_stats_t;
+
+void mymalloc_stats(mymalloc_stats_t *stats);
+
+/* Print the statistics to a file descriptor. Also done at exit when the
+ * environment variable MYMALLOC_STATS is set. */
+void mymalloc_stats_print(int fd);
+
 #endif /* ifndef _MALLOC_H */
@@ -1,165 +1,1378 @@
+#define _GNU_SOURCE   // mremap
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/mman.h>
 #include <pthread.h>
 #include <assert.h>
-#include "debug.h"   
-#include "malloc.h"  
+#include <stdint.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sched.h>
+#include "debug.h"
+#include "malloc.h"
 
+/*
+ * Block header with boundary tags.
+ *
+ * prev_size lets a block find its physical predecessor, and the size of the
+ * block itself leads to its successor, so a freed block merges with free
+ * neighbours in constant time. Every mapping starts with a block flagged
+ * BLOCK_FIRST and ends in a zero-sized fence that is never free.
+ *
+ * Anonymous mappings start out zeroed. BLOCK_FRESH marks blocks whose
+ * payload has not been touched since, which mycalloc does not need to clear.
+ * Only the headers of such blocks are written while they sit in the bins.
+ *
+ * While a block is allocated it records the thread cache it was handed out
+ * by, so another thread freeing it can give it back, see remote_free.
+ */
 typedef struct block {
-    size_t size;       
-    struct block *next;  
-    int free;            
+    size_t prev_size;      // payload size of the physically preceding block
+    size_t size;           // payload size, the low bits hold BLOCK_* flags
+    union {
+        struct block *next;    // bin or thread cache link
+        struct tcache *owner;  // cache it was allocated from, or NULL
+    };
+    union {
+        struct block *prev;    // bin link while the block is free
+        size_t requested;      // bytes asked for while it is allocated
+    };
 } block_t;
 
 #define BLOCK_SIZE sizeof(block_t)
 
-block_t *free_list = NULL; 
-pthread_mutex_t global_lock;
+#define BLOCK_FREE 1UL     // block is in a shared bin
+#define BLOCK_FIRST 2UL    // block has no physical predecessor
+#define BLOCK_MMAPPED 4UL  // block is a mapping of its own, see map_block
+#define BLOCK_FRESH 8UL    // payload was never handed out, so it is all zero
+#define BLOCK_FLAGS 15UL
 
 /*
- * Insert block into free list sorted by address.
+ * Arena regions.
+ *
+ * Blocks up to mmap_threshold are carved out of large regions instead of
+ * mapping a page at a time. Larger ones get a mapping of their own that is
+ * unmapped as soon as they are freed. Like glibc, freeing such a block raises
+ * the threshold to its size (up to MMAP_THRESHOLD_MAX), so a program that
+ * keeps allocating buffers of one size stops mapping and unmapping them.
+ * Each new region is twice as large as the one before, from REGION_MIN up
+ * to REGION_MAX. A region whose memory is all free
+ * again is kept for reuse while the idle regions add up to no more than
+ * REGION_IDLE_MAX bytes, and unmapped otherwise.
+ *
+ * Regions are aligned to REGION_MAX, like glibc's heaps, so a block finds
+ * its region by masking its address. Blocks larger than REGION_BLOCK_MAX
+ * always get a mapping of their own, so no region outgrows REGION_MAX.
+ *
+ * With MYMALLOC_HUGEPAGES set, regions are whole HUGE_PAGEs, backed by
+ * hugetlbfs pages (MAP_HUGETLB) while the system has some reserved and
+ * otherwise advised as transparent huge pages (MADV_HUGEPAGE), so large
+ * heaps need far fewer TLB entries. If neither is available they end up
+ * as normal pages.
  */
-void insert_free_block(block_t *block) {
-    block->free = 1;
-    if (!free_list || free_list > block) {
-        block->next = free_list;
-        free_list = block;
-    } else {
-        block_t *curr = free_list;
-        while (curr->next && curr->next < block) {
-            curr = curr->next;
+#define MMAP_THRESHOLD (128 * 1024)   // default, see MYMALLOC_MMAP_THRESHOLD
+#define MMAP_THRESHOLD_MAX (32UL << 20)
+#define REGION_MIN (1UL << 20)
+#define REGION_MAX (64UL << 20)
+#define REGION_IDLE_MAX (16UL << 20)
+#define REGION_BLOCK_MAX (REGION_MAX / 2)
+#define HUGE_PAGE (2UL << 20)
+
+typedef struct region {
+    struct region *next;
+    struct region *prev;
+    size_t size;           // bytes mapped, this header included
+    struct arena *arena;   // arena the region belongs to
+} __attribute__((aligned(16))) region_t;
+
+/*
+ * Segregated free lists.
+ *
+ * Free blocks are kept in bins by size: one bin per 16-byte class up to
+ * SMALL_MAX and one bin per power of two above it. A request looks at the
+ * bin of its own class first and otherwise takes the head of the next
+ * non-empty bin, which bin_map finds without walking the empty ones.
+ */
+#define ALIGNMENT 16
+#define SMALL_MAX 1024
+#define SMALL_BINS (SMALL_MAX / ALIGNMENT)
+#define LARGE_BINS 54   // 2^10 .. 2^63
+#define NUM_BINS (SMALL_BINS + LARGE_BINS)
+#define MAX_REQUEST (SIZE_MAX / 2)   // larger requests always fail
+
+/*
+ * Cache line mode.
+ *
+ * With MYMALLOC_CACHELINE set, every block (header and payload) is a
+ * multiple of CACHE_LINE bytes and every payload starts on a cache line, so
+ * objects handed to different threads never share a line. Regions start on
+ * a page, so the first payload, after region_t and one header, does too.
+ */
+#define CACHE_LINE 64
+
+/*
+ * Hardened mode.
+ *
+ * With MYMALLOC_HARDENED set in the environment (or defined at compile
+ * time), every block gets CHECK_SIZE more bytes for two words right after
+ * the requested bytes: a canary, and a check of the header fields tied to
+ * the block's address. myfree and myrealloc verify both and abort on a
+ * stray pointer, a corrupted header or an overflow into the canary. A freed
+ * block has its canary replaced by a freed mark, which a second free
+ * reports, and then waits in a per-thread quarantine of QUARANTINE_BLOCKS
+ * blocks before it can be reused, so double frees and writes after free in
+ * that window do not reach the free lists. When the mode is off, it costs
+ * one predictable branch per call.
+ */
+#define CHECK_SIZE 16
+#define CANARY 0x5ca1ab1ec0ffee11UL
+#define FREED_MARK 0xdeadbeeff7eed00dUL
+#define HEADER_MAGIC 0x6d796d616c6c6f63UL
+
+_Static_assert(NUM_BINS == MYMALLOC_SIZE_CLASSES, "size classes in malloc.h");
+
+/*
+ * Arenas.
+ *
+ * The heap is split into arena_count arenas, each with its own lock, bins
+ * and regions: one per CPU by default, see MYMALLOC_ARENAS. A thread takes
+ * its arena from the CPU it first allocates on (round-robin if there are
+ * more arenas than CPUs), and when that arena is locked it moves on to the
+ * next one that is not. A freed block always goes back to the arena of its
+ * region.
+ */
+typedef struct arena {
+    pthread_mutex_t lock;
+    block_t *bins[NUM_BINS];
+    uint64_t bin_map[(NUM_BINS + 63) / 64];
+    region_t *regions;
+    size_t next_region_size;
+    size_t idle_bytes;         // size of the regions that are all free
+    size_t mapped_bytes;       // size of all its regions
+    size_t contention;         // times the lock was already held, atomic
+} __attribute__((aligned(CACHE_LINE))) arena_t;
+
+static arena_t arenas[MYMALLOC_ARENAS_MAX] = {
+    [0 ... MYMALLOC_ARENAS_MAX - 1] = {
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .next_region_size = REGION_MIN,
+    },
+};
+static unsigned int arena_count = 1;
+static unsigned int cpu_count = 1;
+static unsigned int next_arena = 0;         // round-robin assignment, atomic
+
+// Protects the lists of thread caches and the usage of exited threads
+pthread_mutex_t global_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t mmap_threshold = MMAP_THRESHOLD;  // raised without the lock, atomic
+static int mmap_threshold_fixed = 0;       // set through the environment
+static size_t page_size;
+static size_t block_align = ALIGNMENT;     // CACHE_LINE in cache line mode
+static int huge_pages = 0;                 // set through the environment
+static int hugetlb_failed = 0;             // no MAP_HUGETLB pages to be had
+#ifdef MYMALLOC_HARDENED
+#define hardened 1
+#else
+static int hardened = 0;                   // see MYMALLOC_HARDENED
+#endif
+
+// Updated with atomics, as blocks are mapped and unmapped without the lock
+static size_t mapped_bytes = 0;
+static size_t peak_mapped_bytes = 0;
+static size_t lock_contention = 0;      // times global_lock was already held
+
+/*
+ * Thread caches.
+ *
+ * Each thread keeps recently freed small blocks in bins of the same 16-byte
+ * size classes. mymalloc and myfree only take an arena lock when a bin is
+ * empty (refill) or overfull (return half of it to the arenas' bins).
+ *
+ * A small block freed by a thread other than the one that allocated it is
+ * pushed on the owner's remote stack with a compare-and-swap instead. The
+ * owner takes the whole stack with one exchange when a cache bin runs empty,
+ * so a producer and a consumer thread pass blocks back and forth without
+ * any lock. As blocks only ever leave the stack all at once, there is
+ * no ABA problem. A cache whose thread exited is marked dead: its blocks
+ * freed later go straight back to their arenas, and a push that raced with
+ * the exit takes the stack back itself, see remote_free.
+ */
+#define TCACHE_BINS SMALL_BINS
+#define TCACHE_BIN_LIMIT 64
+#define QUARANTINE_BLOCKS 256
+
+typedef struct tcache {
+    block_t *bins[TCACHE_BINS];
+    unsigned int counts[TCACHE_BINS];
+    arena_t *arena;        // arena the thread allocates from
+    block_t *remote;       // blocks freed by other threads, see remote_free
+    size_t remote_count;
+    int dead;              // the thread exited, accessed atomically
+    block_t *quarantine[QUARANTINE_BLOCKS];   // hardened mode, see quarantine
+    unsigned int quarantine_next;
+    size_t requested;      // bytes asked for by allocations made by this thread
+    size_t reserved;       // bytes (with headers) those allocations hold
+    size_t allocs[NUM_BINS];   // allocations per size class
+    size_t frees[NUM_BINS];    // frees per size class
+    struct tcache *next;   // link in spare_caches once the thread exits
+    struct tcache *next_all;
+} tcache_t;
+
+static __thread tcache_t *tcache = NULL;
+static __thread int tcache_shutdown = 0;
+static tcache_t *spare_caches = NULL;   // protected by global_lock
+static tcache_t *all_caches = NULL;     // protected by global_lock
+
+// Usage of threads that no longer have a cache, protected by global_lock
+static size_t global_requested = 0;
+static size_t global_reserved = 0;
+static size_t global_allocs[NUM_BINS];
+static size_t global_frees[NUM_BINS];
+static pthread_key_t tcache_key;
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+static inline size_t block_size(const block_t *block) {
+    return block->size & ~BLOCK_FLAGS;
+}
+
+static inline int block_is_free(const block_t *block) {
+    return block->size & BLOCK_FREE;
+}
+
+static inline block_t *next_block(block_t *block) {
+    return (block_t *)((char *)(block + 1) + block_size(block));
+}
+
+static inline block_t *prev_block(block_t *block) {
+    return (block_t *)((char *)block - block->prev_size - BLOCK_SIZE);
+}
+
+/*
+ * Set the payload size of block, keeping its flags and the successor's tag.
+ */
+static void set_block_size(block_t *block, size_t size) {
+    block->size = size | (block->size & BLOCK_FLAGS);
+    next_block(block)->prev_size = size;
+}
+
+/*
+ * Take global_lock, counting how often another thread already held it.
+ */
+static void lock_global(void) {
+    if (pthread_mutex_trylock(&global_lock) != 0) {
+        __atomic_add_fetch(&lock_contention, 1, __ATOMIC_RELAXED);
+        pthread_mutex_lock(&global_lock);
+    }
+}
+
+static void unlock_global(void) {
+    pthread_mutex_unlock(&global_lock);
+}
+
+/*
+ * The arena a block carved out of a region belongs to.
+ */
+static inline arena_t *block_arena(block_t *block) {
+    return ((region_t *)((uintptr_t)block & ~(REGION_MAX - 1)))->arena;
+}
+
+/*
+ * Take the lock of arena, counting how often another thread already held it.
+ */
+static void lock_arena(arena_t *arena) {
+    if (pthread_mutex_trylock(&arena->lock) != 0) {
+        __atomic_add_fetch(&arena->contention, 1, __ATOMIC_RELAXED);
+        pthread_mutex_lock(&arena->lock);
+    }
+}
+
+static void unlock_arena(arena_t *arena) {
+    pthread_mutex_unlock(&arena->lock);
+}
+
+/*
+ * The arena for a new thread: the one of the CPU it runs on, or the next
+ * in turn if that is unknown or there are more arenas than CPUs.
+ */
+static arena_t *pick_arena(void) {
+    int cpu = arena_count <= cpu_count ? sched_getcpu() : -1;
+    if (cpu < 0)
+        cpu = __atomic_fetch_add(&next_arena, 1, __ATOMIC_RELAXED);
+    return &arenas[(unsigned int)cpu % arena_count];
+}
+
+/*
+ * Lock an arena to allocate from: the thread's own, or else the first other
+ * one that is not locked, which becomes the thread's arena. Waits for its
+ * own arena only when all of them are busy.
+ */
+static arena_t *lock_any_arena(tcache_t *tc) {
+    arena_t *arena = tc ? tc->arena : pick_arena();
+    if (pthread_mutex_trylock(&arena->lock) == 0)
+        return arena;
+    __atomic_add_fetch(&arena->contention, 1, __ATOMIC_RELAXED);
+    for (unsigned int i = 1; i < arena_count; i++) {
+        arena_t *other = &arenas[(arena - arenas + i) % arena_count];
+        if (pthread_mutex_trylock(&other->lock) == 0) {
+            if (tc)
+                tc->arena = other;
+            return other;
+        }
+    }
+    pthread_mutex_lock(&arena->lock);
+    return arena;
+}
+
+/*
+ * Add delta (negative when unmapping) to the bytes mapped by the allocator.
+ */
+static void count_mapped(ssize_t delta) {
+    size_t mapped = __atomic_add_fetch(&mapped_bytes, delta, __ATOMIC_RELAXED);
+    size_t peak = __atomic_load_n(&peak_mapped_bytes, __ATOMIC_RELAXED);
+    while (mapped > peak &&
+           !__atomic_compare_exchange_n(&peak_mapped_bytes, &peak, mapped, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+/*
+ * Round a request up to its size class, such that the block with its header
+ * is a multiple of block_align.
+ */
+static size_t round_size(size_t s) {
+    if (hardened)
+        s += CHECK_SIZE;
+    if (s == 0)
+        s = 1;
+    return ((s + BLOCK_SIZE + block_align - 1) & ~(block_align - 1)) - BLOCK_SIZE;
+}
+
+/*
+ * The bin a free block of the given size belongs to. Every block in a bin
+ * is at least as large as the bin's smallest size.
+ */
+static size_t bin_index(size_t size) {
+    if (size <= SMALL_MAX)
+        return size / ALIGNMENT - 1;
+    return SMALL_BINS + (63 - __builtin_clzl(size)) - 10;
+}
+
+static void bin_insert(arena_t *arena, block_t *block) {
+    size_t idx = bin_index(block_size(block));
+    block->size |= BLOCK_FREE;
+    block->prev = NULL;
+    block->next = arena->bins[idx];
+    if (arena->bins[idx])
+        arena->bins[idx]->prev = block;
+    arena->bins[idx] = block;
+    arena->bin_map[idx / 64] |= 1UL << (idx % 64);
+}
+
+static void bin_remove(arena_t *arena, block_t *block) {
+    size_t idx = bin_index(block_size(block));
+    if (block->prev)
+        block->prev->next = block->next;
+    else
+        arena->bins[idx] = block->next;
+    if (block->next)
+        block->next->prev = block->prev;
+    if (!arena->bins[idx])
+        arena->bin_map[idx / 64] &= ~(1UL << (idx % 64));
+    block->size &= ~BLOCK_FREE;
+}
+
+/*
+ * First non-empty bin at or after idx, NUM_BINS if there is none.
+ */
+static size_t next_bin(arena_t *arena, size_t idx) {
+    while (idx < NUM_BINS) {
+        uint64_t word = arena->bin_map[idx / 64] & (~0UL << (idx % 64));
+        if (word)
+            return (idx & ~63UL) + __builtin_ctzl(word);
+        idx = (idx & ~63UL) + 64;
+    }
+    return NUM_BINS;
+}
+
+/*
+ * Take a free block of at least s bytes (already rounded) out of the bins.
+ */
+static block_t *bin_take(arena_t *arena, size_t s) {
+    size_t idx = bin_index(s);
+    if (s > SMALL_MAX) {
+        // A power-of-two bin may hold blocks smaller than s, so scan it
+        block_t *block = arena->bins[idx];
+        while (block && block_size(block) < s)
+            block = block->next;
+        if (block) {
+            bin_remove(arena, block);
+            return block;
         }
-        block->next = curr->next;
-        curr->next = block;
+        idx++;
     }
+    idx = next_bin(arena, idx);
+    if (idx == NUM_BINS)
+        return NULL;
+    block_t *block = arena->bins[idx];
+    bin_remove(arena, block);
+    return block;
+}
+
+/*
+ * The region block belongs to if block spans all of it, NULL otherwise.
+ */
+static region_t *idle_region(block_t *block) {
+    if (!(block->size & BLOCK_FIRST))
+        return NULL;
+    if (next_block(block)->size != 0)   // only the fence has size 0
+        return NULL;
+    return (region_t *)block - 1;
 }
 
+static void unmap_region(arena_t *arena, region_t *region) {
+    debug_printf("free: unmapping idle region of size %zu\n", region->size);
+    if (region->prev)
+        region->prev->next = region->next;
+    else
+        arena->regions = region->next;
+    if (region->next)
+        region->next->prev = region->prev;
+    arena->mapped_bytes -= region->size;
+    count_mapped(-(ssize_t)region->size);
+    munmap(region, region->size);
+}
 
 /*
- * join adjacent free blocks.
+ * Merge block with its free physical neighbours and put the result in its
+ * bin, or unmap its region if that leaves too much idle memory. The caller
+ * must hold the lock of the block's arena.
  */
-void join_free_list() {
-    block_t *curr = free_list;
-    while (curr && curr->next) {
-        char *end_curr = (char *)(curr + 1) + curr->size;
-        if (end_curr == (char *)curr->next) {
-            size_t new_size = curr->size + BLOCK_SIZE + curr->next->size;
+static void free_block(arena_t *arena, block_t *block) {
+    block_t *next = next_block(block);
+    if (block_is_free(next)) {
+        // the header of next becomes payload, so the result is not fresh
+        block->size &= ~BLOCK_FRESH;
+        size_t new_size = block_size(block) + BLOCK_SIZE + block_size(next);
+        debug_printf("free: join blocks of size %zu and %zu to new block of size %zu\n",
+                     block_size(block), block_size(next), new_size);
+        bin_remove(arena, next);
+        set_block_size(block, new_size);
+    }
+    if (!(block->size & BLOCK_FIRST)) {
+        block_t *prev = prev_block(block);
+        if (block_is_free(prev)) {
+            prev->size &= ~BLOCK_FRESH;
+            size_t new_size = block_size(prev) + BLOCK_SIZE + block_size(block);
             debug_printf("free: join blocks of size %zu and %zu to new block of size %zu\n",
-                         curr->size, curr->next->size, new_size);
-            curr->size = new_size;
-            curr->next = curr->next->next;
-        } else {
-            curr = curr->next;
+                         block_size(prev), block_size(block), new_size);
+            bin_remove(arena, prev);
+            set_block_size(prev, new_size);
+            block = prev;
         }
     }
+
+    region_t *region = idle_region(block);
+    if (region) {
+        if (arena->idle_bytes + region->size > REGION_IDLE_MAX) {
+            unmap_region(arena, region);
+            return;
+        }
+        arena->idle_bytes += region->size;
+    }
+    bin_insert(arena, block);
 }
 
+/*
+ * Round size up to a multiple of the page size.
+ */
+static size_t page_round(size_t size) {
+    return (size + page_size - 1) & ~(page_size - 1);
+}
 
 /*
- * implementation using mmap and a free list.
+ * Replace the reserved range at start with memory backed by huge pages:
+ * hugetlbfs pages if there are any, transparent huge pages otherwise.
  */
-void *mymalloc(size_t s) {
-    pthread_mutex_lock(&global_lock);
-    size_t page_size = sysconf(_SC_PAGE_SIZE);
-    block_t *current = free_list, *prev = NULL;
-    
-    while (current) {
-        if (current->free && current->size >= s) {
-            // Remove block from free list
-            if (prev)
-                prev->next = current->next;
-            else
-                free_list = current->next;
-            current->free = 0;
-            pthread_mutex_unlock(&global_lock);
-            return (void *)(current + 1);
+static int map_huge(char *start, size_t size) {
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED;
+    if (!hugetlb_failed) {
+        if (mmap(start, size, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB,
+                 -1, 0) != MAP_FAILED)
+            return 1;
+        debug_printf("malloc: no hugetlbfs pages, using transparent huge pages\n");
+        hugetlb_failed = 1;
+    }
+    if (mmap(start, size, PROT_READ | PROT_WRITE, flags, -1, 0) == MAP_FAILED)
+        return 0;
+    madvise(start, size, MADV_HUGEPAGE);   // fails harmlessly without THP
+    return 1;
+}
+
+/*
+ * Map size bytes aligned to REGION_MAX, by mapping REGION_MAX more and
+ * unmapping what lies outside the aligned range. With huge pages, the
+ * range is only reserved at first and then mapped by map_huge.
+ */
+static void *map_aligned(size_t size) {
+    int prot = huge_pages ? PROT_NONE : PROT_READ | PROT_WRITE;
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | (huge_pages ? MAP_NORESERVE : 0);
+    char *p = mmap(NULL, size + REGION_MAX, prot, flags, -1, 0);
+    if (p == MAP_FAILED)
+        return MAP_FAILED;
+    char *start = (char *)(((uintptr_t)p + REGION_MAX - 1) & ~(REGION_MAX - 1));
+    if (start != p)
+        munmap(p, start - p);
+    munmap(start + size, p + REGION_MAX - start);
+    if (huge_pages && !map_huge(start, size)) {
+        munmap(start, size);
+        return MAP_FAILED;
+    }
+    return start;
+}
+
+/*
+ * Round a region size up to whole huge pages when they are used.
+ */
+static size_t region_round(size_t size) {
+    if (!huge_pages)
+        return size;
+    return (size + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1);
+}
+
+/*
+ * Map a new region for arena with room for at least s bytes (at most
+ * REGION_BLOCK_MAX) and return its memory as one block followed by the
+ * fence.
+ */
+static block_t *map_region(arena_t *arena, size_t s) {
+    size_t needed = page_round(sizeof(region_t) + s + 2 * BLOCK_SIZE);
+    size_t size = region_round(arena->next_region_size > needed ?
+                               arena->next_region_size : needed);
+    void *p = map_aligned(size);
+    // Retry with the smallest region that fits before giving up
+    if (p == MAP_FAILED && size > needed && size > REGION_MIN) {
+        size = region_round(needed > REGION_MIN ? needed : REGION_MIN);
+        p = map_aligned(size);
+    }
+    if (p == MAP_FAILED) {
+        return NULL;
+    }
+    if (size >= arena->next_region_size && arena->next_region_size < REGION_MAX)
+        arena->next_region_size *= 2;
+    arena->mapped_bytes += size;
+    count_mapped(size);
+
+    region_t *region = (region_t *)p;
+    region->size = size;
+    region->arena = arena;
+    region->prev = NULL;
+    region->next = arena->regions;
+    if (arena->regions)
+        arena->regions->prev = region;
+    arena->regions = region;
+
+    block_t *block = (block_t *)(region + 1);
+    block->prev_size = 0;
+    block->size = BLOCK_FIRST | BLOCK_FRESH;
+    block->next = NULL;
+    block->prev = NULL;
+    block_t *fence = (block_t *)((char *)p + size - BLOCK_SIZE);
+    fence->size = 0;
+    set_block_size(block, size - sizeof(region_t) - 2 * BLOCK_SIZE);
+    return block;
+}
+
+/*
+ * Map a block of its own with at least s bytes of payload aligned to
+ * alignment. It has no neighbours and no fence, and myfree unmaps it right
+ * away. prev_size holds the offset of the header from the mapping's start.
+ */
+static block_t *map_block(size_t s, size_t alignment) {
+    size_t extra = alignment > ALIGNMENT ? alignment : 0;
+    size_t mmap_size = page_round(s + BLOCK_SIZE + extra);
+    void *p = mmap(NULL, mmap_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        return NULL;
+    }
+    debug_printf("malloc: large block - mmap region of size %zu\n", mmap_size);
+    if (huge_pages && mmap_size >= HUGE_PAGE)
+        madvise(p, mmap_size, MADV_HUGEPAGE);
+    count_mapped(mmap_size);
+    uintptr_t payload = (uintptr_t)p + BLOCK_SIZE;
+    if (extra)
+        payload = (payload + alignment - 1) & ~(alignment - 1);
+    block_t *block = (block_t *)payload - 1;
+    block->prev_size = (char *)block - (char *)p;
+    block->size = ((char *)p + mmap_size - (char *)payload) |
+                  BLOCK_FIRST | BLOCK_MMAPPED | BLOCK_FRESH;
+    block->next = NULL;
+    return block;
+}
+
+static void unmap_block(block_t *block) {
+    size_t size = block_size(block);
+    debug_printf("free: unmapping large block of size %zu\n", size);
+    if (!mmap_threshold_fixed && size <= MMAP_THRESHOLD_MAX) {
+        size_t threshold = __atomic_load_n(&mmap_threshold, __ATOMIC_RELAXED);
+        while (size > threshold &&
+               !__atomic_compare_exchange_n(&mmap_threshold, &threshold, size, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            ;
+    }
+    count_mapped(-(ssize_t)(block->prev_size + BLOCK_SIZE + size));
+    munmap((char *)block - block->prev_size, block->prev_size + BLOCK_SIZE + size);
+}
+
+/*
+ * Shrink block to s bytes if the rest is large enough to form a block of
+ * its own, and free the rest.
+ */
+static void split_block(arena_t *arena, block_t *block, size_t s) {
+    size_t size = block_size(block);
+    if (size < s + BLOCK_SIZE + ALIGNMENT)
+        return;
+    set_block_size(block, s);
+    block_t *rest = next_block(block);
+    rest->size = block->size & BLOCK_FRESH;
+    set_block_size(rest, size - s - BLOCK_SIZE);
+    debug_printf("malloc: splitting - blocks of size %zu and %zu created\n",
+                 s, block_size(rest));
+    free_block(arena, rest);
+}
+
+/*
+ * Allocate a block of at least s bytes (already rounded) from the bins or a
+ * new region of arena, and split off what it does not need. The caller must
+ * hold the arena's lock.
+ */
+static block_t *alloc_block(arena_t *arena, size_t s) {
+    block_t *block = bin_take(arena, s);
+    if (block) {
+        region_t *region = idle_region(block);
+        if (region)
+            arena->idle_bytes -= region->size;
+    } else {
+        debug_printf("malloc: block of size %zu not found - mapping a region of size %zu\n",
+                     s, arena->next_region_size);
+        block = map_region(arena, s);
+    }
+    if (!block)
+        return NULL;
+    split_block(arena, block, s);
+    return block;
+}
+
+/*
+ * Resize a block in its region to s bytes (already rounded), growing into
+ * the next block when it is free and returning any excess to the bins.
+ * Returns 0 when the block cannot grow. The caller must hold the lock of the
+ * block's arena.
+ */
+static int resize_block(arena_t *arena, block_t *block, size_t s) {
+    size_t size = block_size(block);
+    if (s > size) {
+        block_t *next = next_block(block);
+        if (!block_is_free(next) || size + BLOCK_SIZE + block_size(next) < s)
+            return 0;
+        debug_printf("realloc: growing block of size %zu into free block of size %zu\n",
+                     size, block_size(next));
+        bin_remove(arena, next);
+        set_block_size(block, size + BLOCK_SIZE + block_size(next));
+    }
+    split_block(arena, block, s);
+    return 1;
+}
+
+/*
+ * Resize a block that has a mapping of its own with mremap, which may move
+ * it. Blocks placed at an offset in their mapping for alignment are left
+ * alone, as the new mapping would not keep the alignment.
+ */
+static block_t *remap_block(block_t *block, size_t s) {
+    if (block->prev_size != 0)
+        return NULL;
+    size_t old_size = block_size(block) + BLOCK_SIZE;
+    size_t new_size = page_round(s + BLOCK_SIZE);
+    if (new_size == old_size)
+        return block;
+    void *p = mremap(block, old_size, new_size, MREMAP_MAYMOVE);
+    if (p == MAP_FAILED)
+        return NULL;
+    debug_printf("realloc: remapped large block from %zu to %zu bytes\n",
+                 old_size, new_size);
+    count_mapped((ssize_t)new_size - (ssize_t)old_size);
+    block = (block_t *)p;
+    block->size = (new_size - BLOCK_SIZE) | BLOCK_FIRST | BLOCK_MMAPPED;
+    return block;
+}
+
+/*
+ * Hand the first count blocks of a cache bin back to the shared bins.
+ */
+static void tcache_flush_bin(tcache_t *tc, size_t idx, unsigned int count) {
+    arena_t *locked = NULL;
+    while (count-- > 0 && tc->bins[idx]) {
+        block_t *block = tc->bins[idx];
+        tc->bins[idx] = block->next;
+        tc->counts[idx]--;
+        // Cached blocks may come from different arenas
+        arena_t *arena = block_arena(block);
+        if (arena != locked) {
+            if (locked)
+                unlock_arena(locked);
+            lock_arena(arena);
+            locked = arena;
         }
-        prev = current;
-        current = current->next;
-    }
-    
-    // if no free block found allocate a new block
-    if (s <= page_size - BLOCK_SIZE) {
-        debug_printf("malloc: block of size %zu not found - calling mmap\n", s);
-        void *p = mmap(NULL, page_size, PROT_READ | PROT_WRITE,
+        free_block(arena, block);
+    }
+    if (locked)
+        unlock_arena(locked);
+}
+
+/*
+ * Return every block on the remote stack of a dead cache to its arena.
+ */
+static void remote_reclaim(tcache_t *tc) {
+    block_t *block = __atomic_exchange_n(&tc->remote, NULL, __ATOMIC_SEQ_CST);
+    size_t reclaimed = 0;
+    while (block) {
+        block_t *next = block->next;
+        arena_t *arena = block_arena(block);
+        lock_arena(arena);
+        free_block(arena, block);
+        unlock_arena(arena);
+        reclaimed++;
+        block = next;
+    }
+    __atomic_sub_fetch(&tc->remote_count, reclaimed, __ATOMIC_RELAXED);
+}
+
+/*
+ * Push a block freed by another thread on the remote stack of its owner.
+ * The owner may exit between the caller's check and the push, after its
+ * last drain. Both sides order their write before their read, so then this
+ * thread sees it dead and takes the stack back.
+ */
+static void remote_free(tcache_t *owner, block_t *block) {
+    block_t *head = __atomic_load_n(&owner->remote, __ATOMIC_RELAXED);
+    do {
+        block->next = head;
+    } while (!__atomic_compare_exchange_n(&owner->remote, &head, block, 1,
+                                          __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+    __atomic_add_fetch(&owner->remote_count, 1, __ATOMIC_RELAXED);
+    if (__atomic_load_n(&owner->dead, __ATOMIC_SEQ_CST))
+        remote_reclaim(owner);
+}
+
+/*
+ * Move the blocks other threads freed into the cache bins. Returns whether
+ * there were any.
+ */
+static int tcache_drain(tcache_t *tc) {
+    if (!__atomic_load_n(&tc->remote, __ATOMIC_RELAXED))
+        return 0;
+    block_t *block = __atomic_exchange_n(&tc->remote, NULL, __ATOMIC_SEQ_CST);
+    size_t drained = 0;
+    while (block) {
+        block_t *next = block->next;
+        size_t idx = bin_index(block_size(block));
+        block->next = tc->bins[idx];
+        tc->bins[idx] = block;
+        if (++tc->counts[idx] > TCACHE_BIN_LIMIT)
+            tcache_flush_bin(tc, idx, TCACHE_BIN_LIMIT / 2);
+        drained++;
+        block = next;
+    }
+    __atomic_sub_fetch(&tc->remote_count, drained, __ATOMIC_RELAXED);
+    return 1;
+}
+
+/*
+ * Give back a freed block that has been counted: unmap it, keep it in a
+ * cache or return it to its arena.
+ */
+static void release_block(tcache_t *tc, block_t *block_ptr) {
+    size_t size = block_size(block_ptr);
+
+    if (block_ptr->size & BLOCK_MMAPPED) {
+        unmap_block(block_ptr);
+        return;
+    }
+    tcache_t *owner = block_ptr->owner;
+    // a dead owner would never take the block off its stack
+    int owner_dead = owner && owner != tc &&
+                     __atomic_load_n(&owner->dead, __ATOMIC_ACQUIRE);
+    if (tc && size <= SMALL_MAX && !owner_dead) {
+        if (owner && owner != tc) {
+            remote_free(owner, block_ptr);
+            return;
+        }
+        size_t idx = bin_index(size);
+        block_ptr->next = tc->bins[idx];
+        tc->bins[idx] = block_ptr;
+        if (++tc->counts[idx] > TCACHE_BIN_LIMIT)
+            tcache_flush_bin(tc, idx, TCACHE_BIN_LIMIT / 2);
+        return;
+    }
+
+    arena_t *arena = block_arena(block_ptr);
+    lock_arena(arena);
+    debug_printf("Freed %zu\n", size);
+    free_block(arena, block_ptr);
+    unlock_arena(arena);
+}
+
+/*
+ * Thread exit: mark the cache dead, return every cached block and keep the
+ * cache for reuse.
+ */
+static void tcache_release(void *arg) {
+    tcache_t *tc = (tcache_t *)arg;
+    __atomic_store_n(&tc->dead, 1, __ATOMIC_SEQ_CST);
+    for (size_t i = 0; i < QUARANTINE_BLOCKS; i++) {
+        if (tc->quarantine[i])
+            release_block(tc, tc->quarantine[i]);
+        tc->quarantine[i] = NULL;
+    }
+    tcache_drain(tc);
+    for (size_t idx = 0; idx < TCACHE_BINS; idx++) {
+        if (tc->bins[idx])
+            tcache_flush_bin(tc, idx, tc->counts[idx]);
+    }
+    lock_global();
+    tc->next = spare_caches;
+    spare_caches = tc;
+    unlock_global();
+    tcache = NULL;
+    tcache_shutdown = 1;
+}
+
+/*
+ * Keep all locks held across fork so the child never inherits one locked
+ * by a thread that does not exist there.
+ */
+static void fork_prepare(void) {
+    pthread_mutex_lock(&global_lock);
+    for (unsigned int i = 0; i < arena_count; i++)
+        pthread_mutex_lock(&arenas[i].lock);
+}
+
+static void fork_done(void) {
+    for (unsigned int i = 0; i < arena_count; i++)
+        pthread_mutex_unlock(&arenas[i].lock);
+    pthread_mutex_unlock(&global_lock);
+}
+
+static void malloc_init(void) {
+    page_size = sysconf(_SC_PAGE_SIZE);
+    char *threshold = getenv("MYMALLOC_MMAP_THRESHOLD");
+    if (threshold) {
+        mmap_threshold = strtoul(threshold, NULL, 10);
+        mmap_threshold_fixed = 1;
+    }
+    char *cacheline = getenv("MYMALLOC_CACHELINE");
+    if (cacheline && *cacheline && *cacheline != '0')
+        block_align = CACHE_LINE;
+    char *huge = getenv("MYMALLOC_HUGEPAGES");
+    if (huge && *huge && *huge != '0')
+        huge_pages = 1;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    cpu_count = cpus < 1 ? 1 : cpus;
+#ifndef MYMALLOC_HARDENED
+    char *harden = getenv("MYMALLOC_HARDENED");
+    if (harden && *harden && *harden != '0')
+        hardened = 1;
+#endif
+    char *count = getenv("MYMALLOC_ARENAS");
+    long n = count ? strtol(count, NULL, 10) : cpus;
+    arena_count = n < 1 ? 1 : n > MYMALLOC_ARENAS_MAX ? MYMALLOC_ARENAS_MAX : n;
+    pthread_key_create(&tcache_key, tcache_release);
+    pthread_atfork(fork_prepare, fork_done, fork_done);
+}
+
+/*
+ * The calling thread's cache, created on first use. NULL if the thread is
+ * already exiting or no memory is left for the cache itself.
+ */
+static tcache_t *tcache_get(void) {
+    if (tcache || tcache_shutdown)
+        return tcache;
+    pthread_once(&init_once, malloc_init);
+
+    lock_global();
+    tcache_t *tc = spare_caches;
+    if (tc)
+        spare_caches = tc->next;
+    unlock_global();
+
+    if (!tc) {
+        void *p = mmap(NULL, sizeof(tcache_t), PROT_READ | PROT_WRITE,
                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-        if (p == MAP_FAILED) {
-            pthread_mutex_unlock(&global_lock);
+        if (p == MAP_FAILED)
             return NULL;
+        tc = (tcache_t *)p;
+        count_mapped(sizeof(tcache_t));
+        lock_global();
+        tc->next_all = all_caches;
+        all_caches = tc;
+        unlock_global();
+    }
+    tc->next = NULL;
+    __atomic_store_n(&tc->dead, 0, __ATOMIC_RELAXED);
+    tc->arena = pick_arena();
+    tcache = tc;
+    pthread_setspecific(tcache_key, tc);
+    return tc;
+}
+
+
+/*
+ * The two check words of an allocated block in hardened mode. They start
+ * right at the end of the requested bytes, so they may be unaligned and
+ * are copied in and out.
+ */
+static inline char *check_words(const block_t *block) {
+    return (char *)(block + 1) + block->requested;
+}
+
+static inline uint64_t header_check(const block_t *block) {
+    return HEADER_MAGIC ^ (uintptr_t)block ^ block->size ^ block->requested ^
+           (uintptr_t)block->owner;
+}
+
+static void arm_block(block_t *block) {
+    uint64_t words[2] = { CANARY ^ (uintptr_t)block, header_check(block) };
+    memcpy(check_words(block), words, sizeof(words));
+}
+
+static void heap_error(const char *what, const block_t *block, const char *op) {
+    dprintf(STDERR_FILENO, "mymalloc: %s at %p in %s\n",
+            what, (void *)(block + 1), op);
+    abort();
+}
+
+/*
+ * Abort unless block is an allocated block whose header and canary are
+ * intact. The header is checked for plausible values before the check words
+ * behind the payload are read.
+ */
+static void check_block(const block_t *block, const char *op) {
+    if ((uintptr_t)(block + 1) % ALIGNMENT != 0)
+        heap_error("misaligned pointer", block, op);
+    if (block->size & BLOCK_FREE)
+        heap_error("double free", block, op);
+    if (block_size(block) > MAX_REQUEST ||
+        block->requested + CHECK_SIZE > block_size(block))
+        heap_error("invalid pointer or corrupted header", block, op);
+    uint64_t words[2];
+    memcpy(words, check_words(block), sizeof(words));
+    if (words[0] == (FREED_MARK ^ (uintptr_t)block))
+        heap_error("double free", block, op);
+    if (words[1] != header_check(block))
+        heap_error("invalid pointer or corrupted header", block, op);
+    if (words[0] != (CANARY ^ (uintptr_t)block))
+        heap_error("buffer overflow", block, op);
+}
+
+/*
+ * Put a freed block in the thread's quarantine and return the block it
+ * pushes out, which is the one to actually free (NULL while the quarantine
+ * fills up). Blocks with a mapping of their own are unmapped right away.
+ */
+static block_t *quarantine(tcache_t *tc, block_t *block) {
+    if (block->size & BLOCK_MMAPPED)
+        return block;
+    block_t *out = tc->quarantine[tc->quarantine_next];
+    tc->quarantine[tc->quarantine_next] = block;
+    tc->quarantine_next = (tc->quarantine_next + 1) % QUARANTINE_BLOCKS;
+    return out;
+}
+
+/*
+ * Count a block handed to the user or freed by a thread without a cache.
+ */
+static void account_global(const block_t *block, int freed) {
+    size_t idx = bin_index(block_size(block));
+    lock_global();
+    if (freed) {
+        global_requested -= block->requested;
+        global_reserved -= block_size(block) + BLOCK_SIZE;
+        global_frees[idx]++;
+    } else {
+        global_requested += block->requested;
+        global_reserved += block_size(block) + BLOCK_SIZE;
+        global_allocs[idx]++;
+    }
+    unlock_global();
+}
+
+/*
+ * Count a block handed to the user, record its owner and arm its checks in
+ * hardened mode. Each thread counts in its own cache; mymalloc_stats adds
+ * them up. Kept inline as it runs on every call.
+ */
+static inline void account_alloc(tcache_t *tc, block_t *block) {
+    block->owner = tc;
+    if (__builtin_expect(hardened, 0))
+        arm_block(block);
+    if (!tc) {
+        account_global(block, 0);
+        return;
+    }
+    tc->requested += block->requested;
+    tc->reserved += block_size(block) + BLOCK_SIZE;
+    tc->allocs[bin_index(block_size(block))]++;
+}
+
+static inline void account_free(tcache_t *tc, const block_t *block) {
+    if (!tc) {
+        account_global(block, 1);
+        return;
+    }
+    tc->requested -= block->requested;
+    tc->reserved -= block_size(block) + BLOCK_SIZE;
+    tc->frees[bin_index(block_size(block))]++;
+}
+
+/*
+ * Find a block of at least s bytes (already rounded): from the thread cache,
+ * a mapping of its own or the shared bins. *fresh tells whether the payload
+ * is still all zero. BLOCK_FRESH is cleared under the arena lock, as threads
+ * freeing a neighbour read the header.
+ */
+static block_t *malloc_block(tcache_t *tc, size_t s, int *fresh) {
+    block_t *block = NULL;
+    *fresh = 0;
+
+    if (tc && s <= SMALL_MAX) {
+        size_t idx = bin_index(s);
+        block = tc->bins[idx];
+        if (!block && tcache_drain(tc))
+            block = tc->bins[idx];
+        if (block) {
+            tc->bins[idx] = block->next;
+            tc->counts[idx]--;
+            return block;
         }
-        block_t *new_block = (block_t *)p;
-        new_block->size = page_size - BLOCK_SIZE;
-        new_block->free = 0;
-        new_block->next = NULL;
-        // If the block is larger than needed, try splitting it into different blocks
-        if (new_block->size >= s + BLOCK_SIZE + 1) {
-            size_t remaining = new_block->size - s - BLOCK_SIZE;
-            new_block->size = s;
-            block_t *split_block = (block_t *)((char *)(new_block + 1) + s);
-            split_block->size = remaining;
-            split_block->free = 1;
-            split_block->next = free_list;
-            free_list = split_block;
-            debug_printf("malloc: splitting - blocks of size %zu and %zu created\n",
-                         s, remaining);
+    }
+
+    if (s > __atomic_load_n(&mmap_threshold, __ATOMIC_RELAXED) || s > REGION_BLOCK_MAX) {
+        block = map_block(s, block_align);
+        if (block) {
+            *fresh = 1;
+            block->size &= ~BLOCK_FRESH;
         }
-        pthread_mutex_unlock(&global_lock);
-        return (void *)(new_block + 1);
+        return block;
+    }
+    arena_t *arena = lock_any_arena(tc);
+    block = alloc_block(arena, s);
+    if (block) {
+        *fresh = (block->size & BLOCK_FRESH) != 0;
+        block->size &= ~BLOCK_FRESH;
+    }
+    unlock_arena(arena);
+    return block;
+}
+
+/*
+ * implementation using mmap and segregated free lists, with a per-thread
+ * cache in front of them for small blocks.
+ */
+void *mymalloc(size_t s) {
+    if (s > MAX_REQUEST)
+        return NULL;
+    tcache_t *tc = tcache_get();
+    int fresh;
+    block_t *block = malloc_block(tc, round_size(s), &fresh);
+    if (!block)
+        return NULL;
+
+    block->requested = s;
+    account_alloc(tc, block);
+    return (void *)(block + 1);
+}
+
+/*
+ * allocate memory aligned to alignment, which must be a power of two.
+ */
+void *mymemalign(size_t alignment, size_t s) {
+    if (alignment & (alignment - 1))
+        return NULL;
+    tcache_t *tc = tcache_get();
+    if (alignment <= block_align)
+        return mymalloc(s);
+    if (s > MAX_REQUEST || alignment > MAX_REQUEST)
+        return NULL;
+    size_t requested = s;
+    s = round_size(s);
+    block_t *block;
+
+    if (s + alignment > __atomic_load_n(&mmap_threshold, __ATOMIC_RELAXED) ||
+        s + alignment > REGION_BLOCK_MAX) {
+        block = map_block(s, alignment);
+        if (block)
+            block->size &= ~BLOCK_FRESH;
     } else {
-        // For large blocks
-        size_t total_size = s + BLOCK_SIZE;
-        size_t num_pages = total_size / page_size;
-        if (total_size % page_size != 0)
-            num_pages++;
-        size_t mmap_size = num_pages * page_size;
-        debug_printf("malloc: large block - mmap region of size %zu\n", mmap_size);
-        void *p = mmap(NULL, mmap_size, PROT_READ | PROT_WRITE,
-                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-        if (p == MAP_FAILED) {
-            pthread_mutex_unlock(&global_lock);
-            return NULL;
+        arena_t *arena = lock_any_arena(tc);
+        // Room to move the payload up to the next aligned address while
+        // leaving a block of at least ALIGNMENT bytes in front of it
+        block = alloc_block(arena, round_size(s + alignment + BLOCK_SIZE + ALIGNMENT));
+        if (block) {
+            uintptr_t payload = (uintptr_t)(block + 1);
+            uintptr_t aligned = (payload + alignment - 1) & ~(alignment - 1);
+            if (aligned != payload && aligned - payload < BLOCK_SIZE + ALIGNMENT)
+                aligned += alignment;
+            if (aligned != payload) {
+                size_t size = block_size(block);
+                size_t gap = aligned - payload;
+                set_block_size(block, gap - BLOCK_SIZE);
+                block_t *lead = block;
+                block = (block_t *)aligned - 1;
+                block->size = 0;
+                set_block_size(block, size - gap);
+                free_block(arena, lead);
+            }
+            split_block(arena, block, s);
+            block->size &= ~BLOCK_FRESH;
         }
-        block_t *new_block = (block_t *)p;
-        new_block->size = mmap_size - BLOCK_SIZE;
-        new_block->free = 0;
-        new_block->next = NULL;
-        pthread_mutex_unlock(&global_lock);
-        return (void *)(new_block + 1);
+        unlock_arena(arena);
     }
+    if (!block)
+        return NULL;
+
+    block->requested = requested;
+    account_alloc(tc, block);
+    return (void *)(block + 1);
 }
 
 /*
- * allocate memory and set to zero.
+ * allocate memory and set to zero. Blocks carved from memory that was never
+ * handed out are zero already; only recycled ones are cleared.
  */
 void *mycalloc(size_t nmemb, size_t s) {
-    size_t total = nmemb * s;
-    void *ptr = mymalloc(total);
-    if (ptr) {
-        // Zero out the user memory 
-        char *cptr = (char *)ptr;
-        for (size_t i = 0; i < total; i++) {
-            cptr[i] = 0;
-        }
+    size_t total;
+    if (__builtin_mul_overflow(nmemb, s, &total) || total > MAX_REQUEST)
+        return NULL;
+    tcache_t *tc = tcache_get();
+    int fresh;
+    block_t *block = malloc_block(tc, round_size(total), &fresh);
+    if (!block)
+        return NULL;
+
+    if (!fresh) {
+        memset(block + 1, 0, total);
         debug_printf("Calloc %zu\n", total);
     }
-    return ptr;
+    block->requested = total;
+    account_alloc(tc, block);
+    return (void *)(block + 1);
 }
 
+/*
+ * resize the block at ptr. It stays in place when it is large enough or its
+ * next block is free, a mapped block is resized with mremap, and only
+ * otherwise is the data copied to a new block.
+ */
+void *myrealloc(void *ptr, size_t s) {
+    if (!ptr)
+        return mymalloc(s);
+    if (s == 0) {
+        myfree(ptr);
+        return NULL;
+    }
+    if (s > MAX_REQUEST)
+        return NULL;
+    tcache_t *tc = tcache_get();
+    size_t requested = s;
+    s = round_size(s);
+    block_t *block = (block_t *)ptr - 1;
+    if (__builtin_expect(hardened, 0))
+        check_block(block, "myrealloc");
+    block_t old = *block;
+    size_t size = block_size(block);
+    block_t *resized = NULL;
+
+    if (block->size & BLOCK_MMAPPED) {
+        resized = remap_block(block, s);
+    } else if (s <= size && size < s + BLOCK_SIZE + ALIGNMENT) {
+        // too little to split off, nothing to do
+        resized = block;
+    } else {
+        arena_t *arena = block_arena(block);
+        lock_arena(arena);
+        if (resize_block(arena, block, s))
+            resized = block;
+        unlock_arena(arena);
+    }
+    if (resized) {
+        resized->requested = requested;
+        account_free(tc, &old);
+        account_alloc(tc, resized);
+        return (void *)(resized + 1);
+    }
+
+    void *new_ptr = mymalloc(requested);
+    if (new_ptr) {
+        memcpy(new_ptr, ptr, size < requested ? size : requested);
+        myfree(ptr);
+    }
+    return new_ptr;
+}
 
 /*
- * either return a small block to the free list or
- * munmap a large block.
+ * either keep a small block in the thread cache, return it to its bin or
+ * munmap a large block. In hardened mode the block is checked first and
+ * goes through the quarantine.
  */
 void myfree(void *ptr) {
     if (!ptr)
         return;
-    pthread_mutex_lock(&global_lock);
     block_t *block_ptr = (block_t *)ptr - 1;
-    block_ptr->free = 1;
-    insert_free_block(block_ptr);
-    join_free_list();
-    debug_printf("Freed %zu\n", block_ptr->size);
-    pthread_mutex_unlock(&global_lock);
+    tcache_t *tc = tcache_get();
+
+    if (__builtin_expect(hardened, 0)) {
+        check_block(block_ptr, "myfree");
+        uint64_t mark = FREED_MARK ^ (uintptr_t)block_ptr;
+        memcpy(check_words(block_ptr), &mark, sizeof(mark));
+        account_free(tc, block_ptr);
+        if (tc && !(block_ptr = quarantine(tc, block_ptr)))
+            return;
+    } else {
+        account_free(tc, block_ptr);
+    }
+    release_block(tc, block_ptr);
+}
+
+/*
+ * the number of bytes usable at ptr, at least as many as requested.
+ */
+size_t mymalloc_usable_size(void *ptr) {
+    if (!ptr)
+        return 0;
+    // The bytes after the requested ones hold the checks in hardened mode
+    if (hardened)
+        return ((block_t *)ptr - 1)->requested;
+    return block_size((block_t *)ptr - 1);
+}
+
+/*
+ * The smallest block size of a size class.
+ */
+static size_t class_size(size_t idx) {
+    if (idx < SMALL_BINS)
+        return (idx + 1) * ALIGNMENT;
+    if (idx == SMALL_BINS)
+        return SMALL_MAX + ALIGNMENT;
+    return 1UL << (idx - SMALL_BINS + 10);
+}
+
+/*
+ * Fill in statistics about the free blocks held in the shared bins and
+ * about the memory held by live allocations. The per-thread counters are
+ * read without stopping their threads, so they are only a snapshot.
+ */
+void mymalloc_stats(mymalloc_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+    lock_global();
+    stats->requested_bytes = global_requested;
+    stats->reserved_bytes = global_reserved;
+    for (size_t idx = 0; idx < NUM_BINS; idx++) {
+        stats->class_size[idx] = class_size(idx);
+        stats->allocs[idx] = global_allocs[idx];
+        stats->frees[idx] = global_frees[idx];
+    }
+    for (tcache_t *tc = all_caches; tc; tc = tc->next_all) {
+        stats->requested_bytes += tc->requested;
+        stats->reserved_bytes += tc->reserved;
+        for (size_t idx = 0; idx < NUM_BINS; idx++) {
+            stats->allocs[idx] += tc->allocs[idx];
+            stats->frees[idx] += tc->frees[idx];
+        }
+        for (size_t idx = 0; idx < TCACHE_BINS; idx++)
+            stats->cached_blocks += tc->counts[idx];
+        stats->cached_blocks +=
+            __atomic_load_n(&tc->remote_count, __ATOMIC_RELAXED);
+        for (size_t i = 0; i < QUARANTINE_BLOCKS; i++)
+            stats->cached_blocks += tc->quarantine[i] != NULL;
+    }
+    unlock_global();
+
+    stats->lock_contention = __atomic_load_n(&lock_contention, __ATOMIC_RELAXED);
+    stats->arenas = arena_count;
+    for (unsigned int i = 0; i < arena_count; i++) {
+        arena_t *arena = &arenas[i];
+        lock_arena(arena);
+        for (size_t idx = 0; idx < NUM_BINS; idx++) {
+            for (block_t *block = arena->bins[idx]; block; block = block->next) {
+                stats->free_blocks++;
+                stats->arena_free[i] += block_size(block);
+                if (block_size(block) > stats->largest_free)
+                    stats->largest_free = block_size(block);
+            }
+        }
+        stats->arena_mapped[i] = arena->mapped_bytes;
+        unlock_arena(arena);
+        stats->free_bytes += stats->arena_free[i];
+        stats->arena_contention[i] = __atomic_load_n(&arena->contention, __ATOMIC_RELAXED);
+        stats->lock_contention += stats->arena_contention[i];
+    }
+    if (stats->free_bytes)
+        stats->external_fragmentation =
+            1.0 - (double)stats->largest_free / stats->free_bytes;
+    if (stats->reserved_bytes)
+        stats->internal_fragmentation =
+            1.0 - (double)stats->requested_bytes / stats->reserved_bytes;
+
+    stats->mapped_bytes = __atomic_load_n(&mapped_bytes, __ATOMIC_RELAXED);
+    stats->peak_mapped_bytes = __atomic_load_n(&peak_mapped_bytes, __ATOMIC_RELAXED);
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+        stats->peak_rss = (size_t)usage.ru_maxrss * 1024;
+}
+
+/*
+ * Write the statistics to fd, one line per size class that was used and one
+ * per arena. Uses dprintf, which does not allocate, so it is safe to call
+ * from anywhere.
+ */
+void mymalloc_stats_print(int fd) {
+    mymalloc_stats_t stats;
+    mymalloc_stats(&stats);
+    dprintf(fd,
+            "==== mymalloc stats ====================\n"
+            "in use: %zu bytes requested, %zu bytes reserved\n"
+            "mapped: %zu bytes, peak %zu bytes, peak RSS %zu bytes\n"
+            "free lists: %zu blocks (%zu bytes, largest %zu), %zu cached\n"
+            "fragmentation: external %.3f, internal %.3f\n"
+            "lock contention: %zu\n",
+            stats.requested_bytes, stats.reserved_bytes,
+            stats.mapped_bytes, stats.peak_mapped_bytes, stats.peak_rss,
+            stats.free_blocks, stats.free_bytes, stats.largest_free,
+            stats.cached_blocks,
+            stats.external_fragmentation, stats.internal_fragmentation,
+            stats.lock_contention);
+    dprintf(fd, "%10s %12s %12s\n", "class", "allocs", "frees");
+    for (size_t idx = 0; idx < MYMALLOC_SIZE_CLASSES; idx++) {
+        if (stats.allocs[idx] || stats.frees[idx])
+            dprintf(fd, "%10zu %12zu %12zu\n",
+                    stats.class_size[idx], stats.allocs[idx], stats.frees[idx]);
+    }
+    dprintf(fd, "%10s %12s %12s %12s\n", "arena", "mapped", "free", "contention");
+    for (size_t i = 0; i < stats.arenas; i++) {
+        dprintf(fd, "%10zu %12zu %12zu %12zu\n", i, stats.arena_mapped[i],
+                stats.arena_free[i], stats.arena_contention[i]);
+    }
+    dprintf(fd, "========================================\n");
+}
+
+// Print the statistics after main finishes when MYMALLOC_STATS is set
+static void stats_at_exit(void) __attribute__((destructor));
+
+static void stats_at_exit(void) {
+    char *dump = getenv("MYMALLOC_STATS");
+    if (dump && *dump && *dump != '0')
+        mymalloc_stats_print(STDERR_FILENO);
 }
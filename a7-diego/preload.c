@@ -0,0 +1,181 @@
+/**
+ * Exports the C allocation functions on top of mymalloc so that the shared
+ * library can replace the system allocator in unmodified programs:
+ *
+ * make libmymalloc.so
+ * LD_PRELOAD=./libmymalloc.so ls -l
+ *
+ * With MYMALLOC_TRACE set to a file name, every call is also recorded there
+ * for bench/replay (see trace.h). A %p in the name is replaced by the process
+ * id, which keeps programs that run others from overwriting their trace.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "malloc.h"
+#include "trace.h"
+
+#undef malloc
+#undef calloc
+#undef realloc
+#undef free
+
+#define EXPORT __attribute__((visibility("default")))
+
+#define TRACE_BUFFER 4096   // records written at once
+
+static int trace_fd = -1;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static trace_record_t trace_buffer[TRACE_BUFFER];
+static size_t trace_count = 0;
+
+static void trace_flush(void) {
+    const char *p = (const char *)trace_buffer;
+    size_t left = trace_count * sizeof(trace_record_t);
+    while (left > 0) {
+        ssize_t n = write(trace_fd, p, left);
+        if (n <= 0)
+            break;
+        p += n;
+        left -= n;
+    }
+    trace_count = 0;
+}
+
+static void trace(uint64_t op, void *ptr, size_t size, void *result) {
+    if (trace_fd < 0)
+        return;
+    pthread_mutex_lock(&trace_lock);
+    trace_buffer[trace_count++] = (trace_record_t) {
+        op, (uintptr_t)ptr, size, (uintptr_t)result
+    };
+    if (trace_count == TRACE_BUFFER)
+        trace_flush();
+    pthread_mutex_unlock(&trace_lock);
+}
+
+// A forked child would mix its calls into the parent's trace
+static void trace_stop_in_child(void) {
+    trace_fd = -1;
+    trace_count = 0;
+}
+
+static void trace_open(void) __attribute__((constructor));
+
+static void trace_open(void) {
+    const char *name = getenv("MYMALLOC_TRACE");
+    if (!name || !*name)
+        return;
+    char path[4096];
+    const char *pid = strstr(name, "%p");
+    if (pid)
+        snprintf(path, sizeof(path), "%.*s%d%s", (int)(pid - name), name,
+                 (int)getpid(), pid + 2);
+    else
+        snprintf(path, sizeof(path), "%s", name);
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0 || write(fd, TRACE_MAGIC, 8) != 8) {
+        perror(path);
+        return;
+    }
+    pthread_atfork(NULL, NULL, trace_stop_in_child);
+    trace_fd = fd;
+}
+
+static void trace_close(void) __attribute__((destructor));
+
+static void trace_close(void) {
+    if (trace_fd < 0)
+        return;
+    pthread_mutex_lock(&trace_lock);
+    trace_flush();
+    close(trace_fd);
+    trace_fd = -1;
+    pthread_mutex_unlock(&trace_lock);
+}
+
+EXPORT void *malloc(size_t size) {
+    void *ptr = mymalloc(size);
+    if (!ptr)
+        errno = ENOMEM;
+    else
+        trace(TRACE_MALLOC, NULL, size, ptr);
+    return ptr;
+}
+
+EXPORT void free(void *ptr) {
+    // recorded first, so the free comes before any reuse of the address
+    if (ptr)
+        trace(TRACE_FREE, ptr, 0, NULL);
+    myfree(ptr);
+}
+
+EXPORT void *calloc(size_t nmemb, size_t size) {
+    void *ptr = mycalloc(nmemb, size);
+    if (!ptr)
+        errno = ENOMEM;
+    else
+        trace(TRACE_MALLOC, NULL, nmemb * size, ptr);
+    return ptr;
+}
+
+EXPORT void *realloc(void *ptr, size_t size) {
+    if (ptr && size == 0)
+        trace(TRACE_FREE, ptr, 0, NULL);
+    void *new_ptr = myrealloc(ptr, size);
+    if (!new_ptr && size)
+        errno = ENOMEM;
+    else if (new_ptr && ptr)
+        trace(TRACE_REALLOC, ptr, size, new_ptr);
+    else if (new_ptr)
+        trace(TRACE_MALLOC, NULL, size, new_ptr);
+    return new_ptr;
+}
+
+EXPORT int posix_memalign(void **memptr, size_t alignment, size_t size) {
+    if (alignment < sizeof(void *) || (alignment & (alignment - 1)))
+        return EINVAL;
+    void *ptr = mymemalign(alignment, size);
+    if (!ptr)
+        return ENOMEM;
+    trace(TRACE_MALLOC, NULL, size, ptr);
+    *memptr = ptr;
+    return 0;
+}
+
+EXPORT void *aligned_alloc(size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1))) {
+        errno = EINVAL;
+        return NULL;
+    }
+    void *ptr = mymemalign(alignment, size);
+    if (!ptr)
+        errno = ENOMEM;
+    else
+        trace(TRACE_MALLOC, NULL, size, ptr);
+    return ptr;
+}
+
+EXPORT void *memalign(size_t alignment, size_t size) {
+    return aligned_alloc(alignment, size);
+}
+
+EXPORT void *valloc(size_t size) {
+    return aligned_alloc(sysconf(_SC_PAGESIZE), size);
+}
+
+EXPORT void *pvalloc(size_t size) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    return aligned_alloc(page, (size + page - 1) & ~(page - 1));
+}
+
+EXPORT size_t malloc_usable_size(void *ptr) {
+    return mymalloc_usable_size(ptr);
+}
@@ -1,15 +1,22 @@
 /**
- * Wrapper for sbrk to collect usage statistics. And printing at the end of
- * a program. Note: calling exit explicitly might skip the stats printing.
+ * Wrappers for sbrk, mmap, mremap and munmap to collect usage statistics. And printing
+ * at the end of a program. Note: calling exit explicitly might skip the stats
+ * printing.
  *
  * If compiling without the provided Makefile, use the following gcc options:
  *
- * gcc -g --Wl,--wrap=sbrk std=gnu11 -I. mymalloc.c sbrk_stats.c prog.c -o prog
+ * gcc -g -Wl,--wrap=sbrk,--wrap=mmap,--wrap=mremap,--wrap=munmap -std=gnu11 -I. mymalloc.c sbrk_stats.c prog.c -o prog
  */
 #include <unistd.h>
 #include <stdio.h>
+#include <sys/mman.h>
 
 extern void *__real_sbrk(intptr_t increment);
+extern void *__real_mmap(void *addr, size_t length, int prot, int flags,
+                         int fd, off_t offset);
+extern void *__real_mremap(void *old_address, size_t old_size,
+                           size_t new_size, int flags, void *new_address);
+extern int __real_munmap(void *addr, size_t length);
 
 static struct {
   unsigned long added;
@@ -17,6 +24,14 @@ static struct {
   unsigned long count;
 } sbrk_stats = { 0 };
 
+static struct {
+  unsigned long mapped;
+  unsigned long unmapped;
+  unsigned long map_count;
+  unsigned long unmap_count;
+  unsigned long remap_count;
+} mmap_stats = { 0 };
+
 /** sbrk wrapper */
 void *__wrap_sbrk(intptr_t increment) {
   sbrk_stats.count++;
@@ -30,20 +45,58 @@ void *__wrap_sbrk(intptr_t increment) {
   return __real_sbrk(increment);
 }
 
+/** mmap wrapper */
+void *__wrap_mmap(void *addr, size_t length, int prot, int flags, int fd,
+                  off_t offset) {
+  mmap_stats.map_count++;
+  mmap_stats.mapped += length;
+
+  return __real_mmap(addr, length, prot, flags, fd, offset);
+}
+
+/** mremap wrapper, growing counts as mapping and shrinking as unmapping */
+void *__wrap_mremap(void *old_address, size_t old_size, size_t new_size,
+                    int flags, void *new_address) {
+  mmap_stats.remap_count++;
+  if (new_size > old_size) {
+    mmap_stats.mapped += new_size - old_size;
+  }
+  else {
+    mmap_stats.unmapped += old_size - new_size;
+  }
+
+  return __real_mremap(old_address, old_size, new_size, flags, new_address);
+}
+
+/** munmap wrapper */
+int __wrap_munmap(void *addr, size_t length) {
+  mmap_stats.unmap_count++;
+  mmap_stats.unmapped += length;
+
+  return __real_munmap(addr, length);
+}
+
 // Make stats print automatically after main finishes
 void print_stats (void) __attribute__ ((destructor));
 
-/** Print some statistics about the use of sbrk */
+/** Print some statistics about the use of sbrk and mmap */
 void print_stats() {
   fprintf(stderr, 
       "==== sbrk stats ========================\n"
       "Total call count: %lu\n"
       "Total memory added: %lu\n"
       //"Total memory returned: %lu\n"
+      "==== mmap stats ========================\n"
+      "mmap calls: %lu, memory mapped: %lu\n"
+      "mremap calls: %lu\n"
+      "munmap calls: %lu, memory unmapped: %lu\n"
       "========================================\n",
       sbrk_stats.count,
-      sbrk_stats.added); /*,
+      sbrk_stats.added, /*,
       //sbrk_stats.returned);*/
+      mmap_stats.map_count, mmap_stats.mapped,
+      mmap_stats.remap_count,
+      mmap_stats.unmap_count, mmap_stats.unmapped);
 }
 
 
@@ -0,0 +1,184 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <assert.h>
+#include "debug.h"
+#include "slab.h"
+
+/*
+ * Slabs.
+ *
+ * A slab is one SLAB_SIZE page: a slab_t header followed by the objects.
+ * Slabs are aligned to SLAB_SIZE, so an object finds its slab by masking its
+ * address and needs no header of its own. A bit set in the bitmap marks a
+ * free object; with at least 8-byte objects the bitmap has at most
+ * SLAB_WORDS words, so finding a free object takes constant time.
+ *
+ * Slabs with free objects are kept on the cache's partial list, full slabs
+ * on no list at all. Slabs are mapped SLAB_BATCH at a time, and a slab
+ * whose objects are all free again goes to the empty list, or is unmapped
+ * once SLAB_EMPTY_MAX slabs are empty.
+ */
+#define SLAB_SIZE 4096
+#define SLAB_ALIGNMENT 8
+#define SLAB_WORDS (SLAB_SIZE / SLAB_ALIGNMENT / 64)
+#define SLAB_BATCH 16
+#define SLAB_EMPTY_MAX 16
+
+typedef struct slab {
+    struct slab_cache *cache;
+    struct slab *next;          // partial or empty list
+    struct slab *prev;
+    unsigned int free;          // number of free objects
+    uint64_t bitmap[SLAB_WORDS];
+} slab_t;
+
+#define SLAB_HEADER ((sizeof(slab_t) + 15) & ~(size_t)15)
+
+struct slab_cache {
+    size_t size;                // object size, a multiple of SLAB_ALIGNMENT
+    unsigned int count;         // objects per slab
+    slab_t *partial;
+    slab_t *empty;
+    unsigned int empty_count;
+    pthread_mutex_t lock;
+};
+
+static inline slab_t *slab_of(void *ptr) {
+    return (slab_t *)((uintptr_t)ptr & ~(uintptr_t)(SLAB_SIZE - 1));
+}
+
+static void list_push(slab_t **list, slab_t *slab) {
+    slab->prev = NULL;
+    slab->next = *list;
+    if (*list)
+        (*list)->prev = slab;
+    *list = slab;
+}
+
+static void list_remove(slab_t **list, slab_t *slab) {
+    if (slab->prev)
+        slab->prev->next = slab->next;
+    else
+        *list = slab->next;
+    if (slab->next)
+        slab->next->prev = slab->prev;
+}
+
+/*
+ * Mark every object of the slab free.
+ */
+static void slab_reset(slab_cache_t *cache, slab_t *slab) {
+    slab->cache = cache;
+    slab->free = cache->count;
+    for (unsigned int w = 0; w < SLAB_WORDS; w++) {
+        unsigned int first = w * 64;
+        if (first + 64 <= cache->count)
+            slab->bitmap[w] = ~0UL;
+        else if (first < cache->count)
+            slab->bitmap[w] = (1UL << (cache->count - first)) - 1;
+        else
+            slab->bitmap[w] = 0;
+    }
+}
+
+/*
+ * Map SLAB_BATCH new slabs onto the empty list. The caller must hold the
+ * cache's lock.
+ */
+static int slab_grow(slab_cache_t *cache) {
+    void *p = mmap(NULL, SLAB_SIZE * SLAB_BATCH, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return 0;
+    debug_printf("slab: mapped %d slabs for objects of size %zu\n",
+                 SLAB_BATCH, cache->size);
+    for (int i = 0; i < SLAB_BATCH; i++) {
+        slab_t *slab = (slab_t *)((char *)p + i * SLAB_SIZE);
+        slab_reset(cache, slab);
+        list_push(&cache->empty, slab);
+    }
+    cache->empty_count += SLAB_BATCH;
+    return 1;
+}
+
+slab_cache_t *slab_create(size_t size) {
+    if (size > SLAB_OBJECT_MAX)
+        return NULL;
+    if (size == 0)
+        size = 1;
+    slab_cache_t *cache = calloc(1, sizeof(slab_cache_t));
+    if (!cache)
+        return NULL;
+    cache->size = (size + SLAB_ALIGNMENT - 1) & ~(size_t)(SLAB_ALIGNMENT - 1);
+    cache->count = (SLAB_SIZE - SLAB_HEADER) / cache->size;
+    pthread_mutex_init(&cache->lock, NULL);
+    return cache;
+}
+
+void *slab_alloc(slab_cache_t *cache) {
+    pthread_mutex_lock(&cache->lock);
+    slab_t *slab = cache->partial;
+    if (!slab) {
+        if (!cache->empty && !slab_grow(cache)) {
+            pthread_mutex_unlock(&cache->lock);
+            return NULL;
+        }
+        slab = cache->empty;
+        list_remove(&cache->empty, slab);
+        cache->empty_count--;
+        list_push(&cache->partial, slab);
+    }
+
+    unsigned int w = 0;
+    while (!slab->bitmap[w])
+        w++;
+    unsigned int idx = w * 64 + __builtin_ctzl(slab->bitmap[w]);
+    slab->bitmap[w] &= slab->bitmap[w] - 1;
+    if (--slab->free == 0)
+        list_remove(&cache->partial, slab);
+    pthread_mutex_unlock(&cache->lock);
+
+    return (char *)slab + SLAB_HEADER + idx * cache->size;
+}
+
+void slab_free(slab_cache_t *cache, void *ptr) {
+    if (!ptr)
+        return;
+    slab_t *slab = slab_of(ptr);
+    assert(slab->cache == cache);
+    unsigned int idx = ((char *)ptr - (char *)slab - SLAB_HEADER) / cache->size;
+    uint64_t bit = 1UL << (idx % 64);
+
+    pthread_mutex_lock(&cache->lock);
+    assert(!(slab->bitmap[idx / 64] & bit));   // double free
+    slab->bitmap[idx / 64] |= bit;
+    if (++slab->free == 1)
+        list_push(&cache->partial, slab);
+    if (slab->free == cache->count) {
+        list_remove(&cache->partial, slab);
+        if (cache->empty_count < SLAB_EMPTY_MAX) {
+            list_push(&cache->empty, slab);
+            cache->empty_count++;
+        } else {
+            debug_printf("slab: unmapping empty slab\n");
+            munmap(slab, SLAB_SIZE);
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void slab_destroy(slab_cache_t *cache) {
+    slab_t *lists[] = { cache->partial, cache->empty };
+    for (int i = 0; i < 2; i++) {
+        slab_t *slab = lists[i];
+        while (slab) {
+            slab_t *next = slab->next;
+            munmap(slab, SLAB_SIZE);
+            slab = next;
+        }
+    }
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
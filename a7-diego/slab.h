@@ -0,0 +1,34 @@
+#ifndef _SLAB_H
+#define _SLAB_H
+
+/* Fixed-size object caches for small objects allocated in large numbers,
+ * like list nodes. Objects are packed in page-sized slabs without a header
+ * of their own, and slab_alloc and slab_free take constant time. A cache
+ * can be shared between threads.
+ *
+ *   slab_cache_t *nodes = slab_create(sizeof(node_t));
+ *   node_t *node = slab_alloc(nodes);
+ *   slab_free(nodes, node);
+ */
+
+#include <stddef.h>
+
+typedef struct slab_cache slab_cache_t;
+
+/* Largest object size a cache can hold */
+#define SLAB_OBJECT_MAX 512
+
+/* Create a cache of objects of the given size (up to SLAB_OBJECT_MAX),
+ * aligned to 8 bytes. Returns NULL if the size is too large. */
+slab_cache_t *slab_create(size_t size);
+
+/* Allocate an object from the cache, NULL when out of memory */
+void *slab_alloc(slab_cache_t *cache);
+
+/* Return an object to the cache it was allocated from */
+void slab_free(slab_cache_t *cache, void *ptr);
+
+/* Release the cache. All of its objects must have been freed. */
+void slab_destroy(slab_cache_t *cache);
+
+#endif /* ifndef _SLAB_H */
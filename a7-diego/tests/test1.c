@@ -38,7 +38,10 @@ int main() {
   // allocate again - we should get the same block
   data = (int *) malloc(ARRAY_ELEMENTS * sizeof(int));
 
+#ifndef MYMALLOC_HARDENED
+  // hardened builds keep freed blocks in quarantine instead
   assert(data == old_ptr);
+#endif
   old_ptr = data;
 
   free(data);
@@ -47,7 +50,9 @@ int main() {
   // allocate a smaller chung - we should still get the same block
   data = (int *) malloc(sizeof(int));
 
+#ifndef MYMALLOC_HARDENED
   assert(data == old_ptr);
+#endif
 
   free(data);
 
@@ -0,0 +1,43 @@
+// Region test
+// many small allocations should be carved out of a few large mappings, and
+// regions that become entirely free should eventually be unmapped
+
+#include <malloc.h>
+
+#include <stdio.h>
+#include <assert.h>
+
+#define SMALL_COUNT 1000000
+#define LARGE_COUNT 1024
+#define LARGE_SIZE (100 * 1024)
+
+static void *small[SMALL_COUNT];
+static void *large[LARGE_COUNT];
+
+int main() {
+  fprintf(stderr,
+      "=======================================================================\n"
+      "This test allocates %d small blocks and then %d blocks of %d bytes.\n"
+      "mmap should be called a few dozen times at most instead of once per\n"
+      "page, and freeing the large blocks should unmap most of the memory.\n"
+      "=======================================================================\n",
+      SMALL_COUNT, LARGE_COUNT, LARGE_SIZE);
+
+  for (int i = 0; i < SMALL_COUNT; i++) {
+    small[i] = malloc(16 + (i % 16) * 8);
+    assert(small[i] != NULL);
+  }
+  for (int i = 0; i < SMALL_COUNT; i++) {
+    free(small[i]);
+  }
+
+  for (int i = 0; i < LARGE_COUNT; i++) {
+    large[i] = malloc(LARGE_SIZE);
+    assert(large[i] != NULL);
+  }
+  for (int i = 0; i < LARGE_COUNT; i++) {
+    free(large[i]);
+  }
+
+  return 0;
+}
@@ -0,0 +1,49 @@
+// Large block test
+// a block above the mmap threshold gets a mapping of its own, and freeing it
+// should give the memory back to the OS right away
+
+#include <malloc.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+
+#define LARGE_SIZE (64 * 1024 * 1024)
+
+/** Resident set size of this process in bytes, from /proc/self/statm */
+long resident_bytes() {
+  long size, resident;
+  FILE *statm = fopen("/proc/self/statm", "r");
+  assert(statm != NULL);
+  assert(fscanf(statm, "%ld %ld", &size, &resident) == 2);
+  fclose(statm);
+  return resident * sysconf(_SC_PAGE_SIZE);
+}
+
+int main() {
+  fprintf(stderr,
+      "=======================================================================\n"
+      "This test allocates and fills a %d MiB buffer and frees it again. The\n"
+      "resident set size should drop back by about that much after the free,\n"
+      "and munmap should be called for it.\n"
+      "=======================================================================\n",
+      LARGE_SIZE >> 20);
+
+  long before = resident_bytes();
+
+  char *data = (char *) malloc(LARGE_SIZE);
+  assert(data != NULL);
+  memset(data, 1, LARGE_SIZE);
+  long during = resident_bytes();
+
+  free(data);
+  long after = resident_bytes();
+
+  fprintf(stderr, "RSS before: %ld KiB, with buffer: %ld KiB, after free: %ld KiB\n",
+          before >> 10, during >> 10, after >> 10);
+  assert(during - before >= LARGE_SIZE / 2);
+  assert(during - after >= LARGE_SIZE / 2);
+
+  return 0;
+}
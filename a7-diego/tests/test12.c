@@ -0,0 +1,76 @@
+// Realloc test
+// growing a block whose neighbour is free should keep it in place, and
+// moving or remapping a block should keep its contents
+
+#include <malloc.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+static void fill(char *p, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    p[i] = (char) (i * 7);
+  }
+}
+
+static void check(const char *p, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    assert(p[i] == (char) (i * 7));
+  }
+}
+
+int main() {
+  fprintf(stderr,
+      "=======================================================================\n"
+      "This test grows a 2048 byte block into its freed 4096 byte neighbour,\n"
+      "which must not move it, then grows it until it moves and finally grows\n"
+      "a 1 MiB block to 64 MiB. The contents must survive every step.\n"
+      "=======================================================================\n");
+
+  char *a = (char *) malloc(2048);
+  char *b = (char *) malloc(4096);
+  char *c = (char *) malloc(2048);
+  fill(a, 2048);
+  free(b);
+
+  char *grown = (char *) realloc(a, 5000);
+#ifndef MYMALLOC_HARDENED
+  // hardened builds keep b in quarantine, so a moves here and not below
+  assert(grown == a);
+#endif
+  check(grown, 2048);
+  fill(grown, 5000);
+
+  // c is in the way now
+  char *moved = (char *) realloc(grown, 8192);
+  assert(moved != NULL);
+#ifndef MYMALLOC_HARDENED
+  assert(moved != grown);
+#endif
+  check(moved, 5000);
+
+  char *shrunk = (char *) realloc(moved, 100);
+  assert(shrunk == moved);
+  check(shrunk, 100);
+
+  size_t size = 1 << 20;
+  char *large = (char *) malloc(size);
+  fill(large, size);
+  for (; size < (64 << 20); size *= 2) {
+    large = (char *) realloc(large, size * 2);
+    assert(large != NULL);
+    check(large, size);
+    fill(large, size * 2);
+  }
+
+  mymalloc_stats_t stats;
+  mymalloc_stats(&stats);
+  assert(stats.requested_bytes == 100 + 2048 + size);
+
+  free(large);
+  free(shrunk);
+  free(c);
+  free(realloc(NULL, 10));
+  return 0;
+}
@@ -0,0 +1,76 @@
+// Statistics test
+// checks the per size class counters, the mapped bytes and the peak RSS
+// reported by mymalloc_stats
+
+#include <malloc.h>
+
+#include <stdio.h>
+#include <unistd.h>
+#include <assert.h>
+
+#define COUNT 1000
+
+#ifdef MYMALLOC_HARDENED
+#define CHECK_SIZE 16   // the check words after every block
+#else
+#define CHECK_SIZE 0
+#endif
+
+static size_t class_of(const mymalloc_stats_t *stats, size_t size) {
+  size_t cls = 0;
+  while (cls + 1 < MYMALLOC_SIZE_CLASSES && stats->class_size[cls + 1] <= size) {
+    cls++;
+  }
+  return cls;
+}
+
+// A block too small to split is handed out whole, so a few requests may be
+// counted in the next classes up
+static size_t count_near(const size_t *counts, size_t cls) {
+  return counts[cls] + counts[cls + 1] + counts[cls + 2];
+}
+
+int main() {
+  fprintf(stderr,
+      "=======================================================================\n"
+      "This test allocates %d blocks of 40 and of 3000 bytes and frees them.\n"
+      "mymalloc_stats should count them in their size classes and report the\n"
+      "mapped memory and peak RSS.\n"
+      "=======================================================================\n",
+      COUNT);
+
+  mymalloc_stats_t before, after;
+  mymalloc_stats(&before);
+
+  void *small[COUNT];
+  void *medium[COUNT];
+  for (int i = 0; i < COUNT; i++) {
+    small[i] = malloc(40);
+    medium[i] = malloc(3000);
+  }
+
+  mymalloc_stats(&after);
+  size_t s = class_of(&after, 48 + CHECK_SIZE);
+  size_t m = class_of(&after, 3008 + CHECK_SIZE);
+  assert(after.class_size[s] == 48 + CHECK_SIZE && after.class_size[m] == 2048);
+  assert(count_near(after.allocs, s) - count_near(before.allocs, s) == COUNT);
+  assert(after.allocs[m] - before.allocs[m] == COUNT);
+  assert(after.requested_bytes - before.requested_bytes == COUNT * (40 + 3000));
+  assert(after.mapped_bytes >= after.reserved_bytes);
+  assert(after.peak_mapped_bytes >= after.mapped_bytes);
+  assert(after.peak_rss >= COUNT * 3000);
+
+  for (int i = 0; i < COUNT; i++) {
+    free(small[i]);
+    free(medium[i]);
+  }
+
+  mymalloc_stats(&after);
+  assert(count_near(after.frees, s) - count_near(before.frees, s) == COUNT);
+  assert(after.frees[m] - before.frees[m] == COUNT);
+  assert(after.requested_bytes == before.requested_bytes);
+  assert(after.cached_blocks > 0);
+
+  mymalloc_stats_print(STDERR_FILENO);
+  return 0;
+}
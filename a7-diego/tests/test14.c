@@ -0,0 +1,69 @@
+// Calloc test
+// calloc must return zeroed memory whether the block is fresh or recycled,
+// and reject sizes whose product overflows
+
+#include <malloc.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#define COUNT 1000
+#define LARGE (512UL << 20)
+
+static void check_zero(const char *p, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    assert(p[i] == 0);
+  }
+}
+
+int main() {
+  fprintf(stderr,
+      "=======================================================================\n"
+      "This test fills and frees blocks, then callocs blocks of the same\n"
+      "sizes, which must be zero. Overflowing sizes must return NULL, and a\n"
+      "512 MiB calloc should only cost the page faults of the pages touched.\n"
+      "=======================================================================\n");
+
+  for (size_t size = 8; size <= 1 << 20; size *= 4) {
+    char *blocks[COUNT / 10];
+    for (int i = 0; i < COUNT / 10; i++) {
+      blocks[i] = (char *) calloc(1, size);
+      assert(blocks[i] != NULL);
+      check_zero(blocks[i], size);
+      memset(blocks[i], 0xff, size);
+    }
+    for (int i = 0; i < COUNT / 10; i++) {
+      free(blocks[i]);
+    }
+    // the recycled blocks must be cleared again
+    for (int i = 0; i < COUNT / 10; i++) {
+      blocks[i] = (char *) calloc(size / 8, 8);
+      check_zero(blocks[i], size);
+    }
+    for (int i = 0; i < COUNT / 10; i++) {
+      free(blocks[i]);
+    }
+  }
+
+  assert(calloc(SIZE_MAX / 2, 3) == NULL);
+  assert(calloc(3, SIZE_MAX / 2) == NULL);
+  assert(calloc((size_t) 1 << 32, (size_t) 1 << 32) == NULL);
+
+  struct timespec begin, end;
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+  char *large = (char *) calloc(LARGE, 1);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  assert(large != NULL);
+  double ms = (end.tv_sec - begin.tv_sec) * 1e3 + (end.tv_nsec - begin.tv_nsec) * 1e-6;
+  fprintf(stderr, "calloc of %lu MiB took %.3f ms\n", LARGE >> 20, ms);
+  // touching every page is the only cost left
+  for (size_t i = 0; i < LARGE; i += 4096) {
+    assert(large[i] == 0);
+  }
+  free(large);
+
+  return 0;
+}
@@ -0,0 +1,58 @@
+// Alignment test
+// mymemalign must honour 16, 32, 64 byte and page alignment, and in cache
+// line mode every small block gets cache lines of its own
+
+#include <malloc.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define COUNT 256
+
+int main() {
+  // read when the allocator starts, so before the first malloc
+  setenv("MYMALLOC_CACHELINE", "1", 1);
+
+  fprintf(stderr,
+      "=======================================================================\n"
+      "This test allocates blocks aligned to 16, 32, 64 and 4096 bytes, small\n"
+      "and large, and %d small blocks in cache line mode, which must each\n"
+      "start on a cache line and not share it with another block.\n"
+      "=======================================================================\n",
+      COUNT);
+
+  size_t alignments[] = { 16, 32, 64, 4096, 1 << 16 };
+  size_t sizes[] = { 1, 24, 100, 1000, 5000, 1 << 20 };
+  for (size_t a = 0; a < sizeof(alignments) / sizeof(alignments[0]); a++) {
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+      char *p = (char *) mymemalign(alignments[a], sizes[s]);
+      assert(p != NULL);
+      assert((uintptr_t) p % alignments[a] == 0);
+      assert(mymalloc_usable_size(p) >= sizes[s]);
+      memset(p, 1, sizes[s]);
+      free(p);
+    }
+  }
+  assert(mymemalign(48, 100) == NULL);
+
+  char *small[COUNT];
+  for (int i = 0; i < COUNT; i++) {
+    small[i] = (char *) malloc(1 + i % 100);
+    assert((uintptr_t) small[i] % 64 == 0);
+  }
+  for (int i = 0; i < COUNT; i++) {
+    uintptr_t last_line = ((uintptr_t) small[i] + i % 100) / 64;
+    for (int j = 0; j < COUNT; j++) {
+      assert(j == i || (uintptr_t) small[j] / 64 > last_line ||
+             (uintptr_t) small[j] + 1 + j % 100 <= (uintptr_t) small[i]);
+    }
+  }
+  for (int i = 0; i < COUNT; i++) {
+    free(small[i]);
+  }
+
+  return 0;
+}
@@ -0,0 +1,77 @@
+// Slab test
+// objects from a slab cache must be distinct, densely packed and reused
+// after they are freed
+
+#include <malloc.h>
+#include <slab.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#define COUNT 100000
+
+typedef struct node {
+  int data;
+  struct node *next;
+} node_t;
+
+static node_t *nodes[COUNT];
+
+int main() {
+  fprintf(stderr,
+      "=======================================================================\n"
+      "This test allocates %d 16-byte list nodes from a slab cache. They must\n"
+      "fit in 16 bytes each (no header), come back after being freed, and a\n"
+      "cache must refuse objects larger than SLAB_OBJECT_MAX.\n"
+      "=======================================================================\n",
+      COUNT);
+
+  assert(slab_create(SLAB_OBJECT_MAX + 1) == NULL);
+
+  slab_cache_t *cache = slab_create(sizeof(node_t));
+  assert(cache != NULL);
+
+  node_t *list = NULL;
+  for (int i = 0; i < COUNT; i++) {
+    nodes[i] = (node_t *) slab_alloc(cache);
+    assert(nodes[i] != NULL);
+    assert((uintptr_t) nodes[i] % 8 == 0);
+    nodes[i]->data = i;
+    nodes[i]->next = list;
+    list = nodes[i];
+  }
+
+  // consecutive objects of one slab are exactly one object apart
+  int adjacent = 0;
+  for (int i = 1; i < COUNT; i++) {
+    adjacent += ((char *) nodes[i] - (char *) nodes[i - 1] == sizeof(node_t));
+  }
+  assert(adjacent > COUNT * 9 / 10);
+
+  int expected = COUNT - 1;
+  for (node_t *n = list; n; n = n->next) {
+    assert(n->data == expected--);
+  }
+
+  // every other node is freed and must be handed out again
+  for (int i = 0; i < COUNT; i += 2) {
+    slab_free(cache, nodes[i]);
+  }
+  for (int i = 0; i < COUNT; i += 2) {
+    node_t *n = (node_t *) slab_alloc(cache);
+    assert(n != NULL);
+    n->data = -1;
+    nodes[i] = n;
+  }
+  for (int i = 1; i < COUNT; i += 2) {
+    assert(nodes[i]->data == i);
+  }
+
+  for (int i = 0; i < COUNT; i++) {
+    slab_free(cache, nodes[i]);
+  }
+  slab_destroy(cache);
+  return 0;
+}
@@ -0,0 +1,59 @@
+// Cross-thread free test
+// blocks freed by another thread go back to the thread that allocated them
+// and are handed out by it again
+
+#include <malloc.h>
+
+#include <stdio.h>
+#include <pthread.h>
+#include <assert.h>
+
+#define COUNT 32
+#define SIZE 64
+
+static void *blocks[COUNT];
+
+static void *consumer(void *arg) {
+  (void) arg;
+  for (int i = 0; i < COUNT; i++) {
+    free(blocks[i]);
+  }
+  return NULL;
+}
+
+int main() {
+  fprintf(stderr,
+      "=======================================================================\n"
+      "This test allocates %d blocks of %d bytes and frees them in another\n"
+      "thread. They should wait on the allocating thread's remote stack and\n"
+      "be the blocks its next %d allocations of that size return.\n"
+      "=======================================================================\n",
+      COUNT, SIZE, COUNT);
+
+  for (int i = 0; i < COUNT; i++) {
+    blocks[i] = malloc(SIZE);
+    assert(blocks[i] != NULL);
+  }
+
+  mymalloc_stats_t before, after;
+  mymalloc_stats(&before);
+  pthread_t thread;
+  pthread_create(&thread, NULL, consumer, NULL);
+  pthread_join(thread, NULL);
+  mymalloc_stats(&after);
+  assert(after.cached_blocks == before.cached_blocks + COUNT);
+  assert(after.free_blocks == before.free_blocks);
+
+  for (int i = 0; i < COUNT; i++) {
+    void *p = malloc(SIZE);
+    int found = 0;
+    for (int j = 0; j < COUNT; j++) {
+      if (blocks[j] == p) {
+        blocks[j] = NULL;
+        found = 1;
+      }
+    }
+    assert(found);
+  }
+  return 0;
+}
@@ -0,0 +1,75 @@
+// Arena test
+// with more arenas than CPUs, threads are spread round-robin, allocate from
+// different arenas and blocks freed by another thread go back to the arena
+// they came from
+
+#include <malloc.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <assert.h>
+
+#define THREADS 4
+#define SIZE 4000
+
+static void *blocks[THREADS];
+
+static void *worker(void *arg) {
+  size_t t = (size_t) arg;
+  blocks[t] = malloc(SIZE);
+  assert(blocks[t] != NULL);
+  return NULL;
+}
+
+int main() {
+  // Round-robin only when there are more arenas than CPUs; with one per CPU
+  // the threads could all run on the same CPU and share its arena
+  long arenas = sysconf(_SC_NPROCESSORS_ONLN) + 1;
+  if (arenas < THREADS)
+    arenas = THREADS;
+  fprintf(stderr,
+      "=======================================================================\n"
+      "This test sets MYMALLOC_ARENAS=%ld and allocates a %d-byte block in each\n"
+      "of %d threads, one after the other. Each block should come from an\n"
+      "arena of its own and go back to it when the main thread frees it.\n"
+      "=======================================================================\n",
+      arenas, SIZE, THREADS);
+  if (arenas > MYMALLOC_ARENAS_MAX) {
+    fprintf(stderr, "More CPUs than arenas, skipped.\n");
+    return 0;
+  }
+
+  // Read when the allocator initializes, so before the first allocation
+  char count[16];
+  snprintf(count, sizeof(count), "%ld", arenas);
+  setenv("MYMALLOC_ARENAS", count, 1);
+  blocks[0] = malloc(SIZE);
+  for (size_t t = 1; t < THREADS; t++) {
+    pthread_t thread;
+    pthread_create(&thread, NULL, worker, (void *) t);
+    pthread_join(thread, NULL);
+  }
+
+  // Arenas are handed out in order, so thread t got arena t
+  mymalloc_stats_t stats;
+  mymalloc_stats(&stats);
+  assert(stats.arenas == (size_t) arenas);
+  for (int i = 0; i < THREADS; i++) {
+    assert(stats.arena_mapped[i] > 0);
+  }
+
+  for (int t = 0; t < THREADS; t++) {
+    free(blocks[t]);
+  }
+  // Every region is all free again and kept, so nearly all of it is in the
+  // bins of its own arena. Hardened builds keep the blocks in quarantine.
+#ifndef MYMALLOC_HARDENED
+  mymalloc_stats(&stats);
+  for (int i = 0; i < THREADS; i++) {
+    assert(stats.arena_free[i] > stats.arena_mapped[i] - 4096);
+  }
+#endif
+  return 0;
+}
@@ -0,0 +1,93 @@
+// Hardened mode test
+// with MYMALLOC_HARDENED set, double frees, overflows and stray pointers
+// abort the process instead of corrupting the free lists
+
+#include <malloc.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <assert.h>
+
+#define SIZE 100
+
+// Keeps the compiler from spotting the overflows below
+static volatile size_t size = SIZE;
+
+// Run f in a child process and return whether it was aborted
+static int aborts(void (*f)(void)) {
+  pid_t pid = fork();
+  if (pid == 0) {
+    // The error report is expected, keep it out of the test output
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, STDERR_FILENO);
+    f();
+    exit(0);
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  return WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT;
+}
+
+static void double_free(void) {
+  char *p = (char *) malloc(SIZE);
+  free(p);
+  free(p);
+}
+
+static void overflow(void) {
+  char *p = (char *) malloc(SIZE);
+  memset(p, 'x', size + 1);
+  free(p);
+}
+
+static void stray_pointer(void) {
+  char *p = (char *) malloc(4 * SIZE);
+  memset(p, 'x', 4 * SIZE);
+  free(p + 2 * SIZE + 32);
+}
+
+static void overflow_realloc(void) {
+  char *p = (char *) malloc(SIZE);
+  p[size] = 'x';
+  p = (char *) realloc(p, 2 * SIZE);
+}
+
+static void valid(void) {
+  char *p = (char *) malloc(SIZE);
+  memset(p, 'x', SIZE);
+  p = (char *) realloc(p, 10 * SIZE);
+  memset(p, 'y', 10 * SIZE);
+  free(p);
+}
+
+int main() {
+  fprintf(stderr,
+      "=======================================================================\n"
+      "This test runs with MYMALLOC_HARDENED=1. A double free, a one-byte\n"
+      "overflow and freeing a pointer into the middle of a block must abort,\n"
+      "and freed blocks must stay in quarantine instead of being reused.\n"
+      "=======================================================================\n");
+
+  // Read when the allocator initializes, so before the first allocation
+  setenv("MYMALLOC_HARDENED", "1", 1);
+
+  assert(!aborts(valid));
+  assert(aborts(double_free));
+  assert(aborts(overflow));
+  assert(aborts(stray_pointer));
+  assert(aborts(overflow_realloc));
+
+  // The block freed last is not handed out again right away
+  char *p = (char *) malloc(SIZE);
+  free(p);
+  char *q = (char *) malloc(SIZE);
+  assert(q != p);
+  assert(mymalloc_usable_size(q) == SIZE);
+  free(q);
+  return 0;
+}
@@ -0,0 +1,50 @@
+// Huge page test
+// with MYMALLOC_HUGEPAGES set, regions are whole 2 MiB pages, and memory
+// comes back usable whether or not the system has huge pages to give
+
+#include <malloc.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define HUGE_PAGE (2UL << 20)
+#define COUNT 100000
+#define SIZE 200
+
+static char *blocks[COUNT];
+
+int main() {
+  fprintf(stderr,
+      "=======================================================================\n"
+      "This test runs with MYMALLOC_HUGEPAGES=1 and allocates %d blocks of\n"
+      "%d bytes. Every arena should hold a multiple of 2 MiB, and the blocks\n"
+      "must be usable even where huge pages are not available.\n"
+      "=======================================================================\n",
+      COUNT, SIZE);
+
+  // Read when the allocator initializes, so before the first allocation
+  setenv("MYMALLOC_HUGEPAGES", "1", 1);
+
+  for (int i = 0; i < COUNT; i++) {
+    blocks[i] = (char *) malloc(SIZE);
+    assert(blocks[i] != NULL);
+    memset(blocks[i], i & 0xff, SIZE);
+  }
+
+  mymalloc_stats_t stats;
+  mymalloc_stats(&stats);
+  size_t mapped = 0;
+  for (size_t i = 0; i < stats.arenas; i++) {
+    assert(stats.arena_mapped[i] % HUGE_PAGE == 0);
+    mapped += stats.arena_mapped[i];
+  }
+  assert(mapped >= (size_t) COUNT * SIZE);
+
+  for (int i = 0; i < COUNT; i++) {
+    assert(blocks[i][SIZE - 1] == (char) (i & 0xff));
+    free(blocks[i]);
+  }
+  return 0;
+}
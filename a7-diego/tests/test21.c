@@ -0,0 +1,77 @@
+// Exited owner test
+// blocks freed after the thread that allocated them has exited go back to
+// their arena instead of waiting on the dead thread's remote stack
+
+#include <malloc.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <assert.h>
+
+#define COUNT 200000
+#define SIZE 64
+
+#ifdef MYMALLOC_HARDENED
+#define QUARANTINE 256  // blocks the main thread holds back before freeing
+#else
+#define QUARANTINE 0
+#endif
+
+static void *blocks[COUNT];
+
+static void *producer(void *arg) {
+  (void) arg;
+  for (int i = 0; i < COUNT; i++) {
+    blocks[i] = malloc(SIZE);
+    assert(blocks[i] != NULL);
+  }
+  return NULL;
+}
+
+int main() {
+  fprintf(stderr,
+      "=======================================================================\n"
+      "This test allocates %d blocks of %d bytes in a thread that exits before\n"
+      "the main thread frees them. They should go back to the free lists, and\n"
+      "allocating blocks again should reuse them before mapping more memory.\n"
+      "=======================================================================\n",
+      COUNT, SIZE);
+
+  // One arena, so the main thread allocates where the producer did
+  setenv("MYMALLOC_ARENAS", "1", 1);
+  void *first = malloc(SIZE);
+  pthread_t thread;
+  pthread_create(&thread, NULL, producer, NULL);
+  pthread_join(thread, NULL);
+
+  mymalloc_stats_t before, freed, after;
+  mymalloc_stats(&before);
+  for (int i = 0; i < COUNT; i++) {
+    free(blocks[i]);
+  }
+  mymalloc_stats(&freed);
+  assert(freed.cached_blocks < before.cached_blocks + 64 + QUARANTINE);
+  // Each block is back in the free lists or its region was unmapped
+  assert(freed.free_bytes + before.mapped_bytes >=
+         before.free_bytes + freed.mapped_bytes + (size_t) (COUNT - QUARANTINE) * SIZE);
+
+  // What is left free is reused before anything new is mapped, allowing
+  // for a header per block
+  size_t reuse = freed.free_bytes / (SIZE + 64);
+  assert(reuse > COUNT / 4);
+  if (reuse > COUNT)
+    reuse = COUNT;
+  for (size_t i = 0; i < reuse; i++) {
+    blocks[i] = malloc(SIZE);
+    assert(blocks[i] != NULL);
+  }
+  mymalloc_stats(&after);
+  assert(after.mapped_bytes <= freed.mapped_bytes);
+
+  for (size_t i = 0; i < reuse; i++) {
+    free(blocks[i]);
+  }
+  free(first);
+  return 0;
+}
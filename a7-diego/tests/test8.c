@@ -0,0 +1,61 @@
+// Size class test
+// frees blocks between live ones and checks that requests are served from the
+// matching free blocks, and that the stats API reports them
+
+#include <malloc.h>
+
+#include <stdio.h>
+#include <assert.h>
+
+#define COUNT 64
+
+int main() {
+  fprintf(stderr,
+      "=======================================================================\n"
+      "This test frees %d blocks of 8192 bytes kept apart by live blocks and\n"
+      "checks that a new request of that size reuses one. mymalloc_stats\n"
+      "should report the free blocks and a fragmentation between 0 and 1.\n"
+      "=======================================================================\n",
+      COUNT);
+
+  void *medium[COUNT];
+  void *large[COUNT];
+  for (int i = 0; i < COUNT; i++) {
+    medium[i] = malloc(2048);
+    large[i] = malloc(8192);
+    assert(medium[i] != NULL && large[i] != NULL);
+  }
+  for (int i = 0; i < COUNT; i++) {
+    free(large[i]);
+  }
+
+  mymalloc_stats_t stats;
+  mymalloc_stats(&stats);
+  fprintf(stderr, "free blocks: %zu, free bytes: %zu, largest: %zu, "
+          "fragmentation: %.3f\n", stats.free_blocks, stats.free_bytes,
+          stats.largest_free, stats.external_fragmentation);
+#ifndef MYMALLOC_HARDENED
+  // hardened builds keep the freed blocks in quarantine instead
+  assert(stats.free_blocks >= COUNT);
+  assert(stats.free_bytes >= COUNT * 8192);
+#endif
+  assert(stats.external_fragmentation >= 0.0 &&
+         stats.external_fragmentation < 1.0);
+
+  // A 8192 byte request must come from one of the freed large blocks
+  void *p = malloc(8192);
+  int found = 0;
+  for (int i = 0; i < COUNT; i++) {
+    found |= (p == large[i]);
+  }
+#ifndef MYMALLOC_HARDENED
+  assert(found);
+#endif
+  free(p);
+
+  for (int i = 0; i < COUNT; i++) {
+    free(medium[i]);
+  }
+
+  return 0;
+}
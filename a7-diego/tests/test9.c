@@ -0,0 +1,45 @@
+// Splitting test
+// a small request served from a large free block should only take what it
+// needs and leave the rest for the following requests
+
+#include <malloc.h>
+
+#include <stdio.h>
+#include <assert.h>
+
+int main() {
+  fprintf(stderr,
+      "=======================================================================\n"
+      "This test frees a 4000 byte block and then allocates 24 and 1000 bytes.\n"
+      "Both should be carved out of the freed block, and mymalloc_stats should\n"
+      "report little internal fragmentation.\n"
+      "=======================================================================\n");
+
+  char *big = (char *) malloc(4000);
+  assert(big != NULL);
+  free(big);
+
+  char *small = (char *) malloc(24);
+  char *medium = (char *) malloc(1000);
+#ifndef MYMALLOC_HARDENED
+  // hardened builds keep the freed block in quarantine instead
+  assert(small == big);
+  assert(medium > small && medium < big + 4000);
+#endif
+
+  mymalloc_stats_t stats;
+  mymalloc_stats(&stats);
+  fprintf(stderr, "requested: %zu bytes, reserved: %zu bytes, internal "
+          "fragmentation: %.3f\n", stats.requested_bytes, stats.reserved_bytes,
+          stats.internal_fragmentation);
+  assert(stats.requested_bytes == 24 + 1000);
+  assert(stats.internal_fragmentation < 0.1);
+
+  free(small);
+  free(medium);
+
+  mymalloc_stats(&stats);
+  assert(stats.requested_bytes == 0 && stats.reserved_bytes == 0);
+
+  return 0;
+}
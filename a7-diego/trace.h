@@ -0,0 +1,26 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+/* Allocation traces, written by libmymalloc.so when MYMALLOC_TRACE names a
+ * file and replayed by bench/replay. A trace is TRACE_MAGIC followed by
+ * trace_record_t records in the order the calls returned. Calls from all
+ * threads go to one trace. */
+
+#include <stdint.h>
+
+#define TRACE_MAGIC "MTRACE1"   /* 8 bytes with the terminating 0 */
+
+enum trace_op {
+  TRACE_MALLOC = 1,   /* result = malloc(size), also calloc and memalign */
+  TRACE_FREE,         /* free(ptr) */
+  TRACE_REALLOC       /* result = realloc(ptr, size) */
+};
+
+typedef struct trace_record {
+  uint64_t op;
+  uint64_t ptr;       /* argument of free and realloc */
+  uint64_t size;      /* requested size of malloc and realloc */
+  uint64_t result;    /* returned address of malloc and realloc */
+} trace_record_t;
+
+#endif /* ifndef _TRACE_H */
@@ -3,8 +3,35 @@
 #include <assert.h>
 #include "linkedlist.h"
 
+#ifdef USE_SLAB
+// Nodes come from a slab cache (a7-diego/slab.h), built with
+// -DUSE_SLAB -I../a7-diego
+#include "slab.h"
+
+static slab_cache_t *node_cache = NULL;
+
+static node_t *node_alloc(void) {
+    if (!node_cache) {
+        node_cache = slab_create(sizeof(node_t));
+    }
+    return node_cache ? (node_t *)slab_alloc(node_cache) : NULL;
+}
+
+static void node_free(node_t *node) {
+    slab_free(node_cache, node);
+}
+#else
+static node_t *node_alloc(void) {
+    return (node_t *)malloc(sizeof(node_t));
+}
+
+static void node_free(node_t *node) {
+    free(node);
+}
+#endif
+
 node_t *cons(int data, node_t *list) {
-    node_t *new_node = (node_t *)malloc(sizeof(node_t));
+    node_t *new_node = node_alloc();
     if (!new_node) {
         perror("Memory allocation failed");
         exit(EXIT_FAILURE);
@@ -45,7 +72,7 @@ void free_list(node_t *list) {
     node_t *current = list;
     while (current != NULL) {
         node_t *next = current->next;
-        free(current);
+        node_free(current);
         current = next;
     }
 }
@@ -4,8 +4,34 @@
 #include <string.h>
 #include "slist.h"
 
+#ifdef USE_SLAB
+// Cells come from a slab cache (a7-diego/slab.h), see USE_SLAB in the
+// Makefile
+#include "slab.h"
+
+static slab_cache_t *slist_cache = 0;
+
+static slist_t *slist_alloc() {
+  if (slist_cache == 0)
+    slist_cache = slab_create(sizeof(slist_t));
+  return slab_alloc(slist_cache);
+}
+
+static void slist_dealloc(slist_t *xs) {
+  slab_free(slist_cache, xs);
+}
+#else
+static slist_t *slist_alloc() {
+  return malloc(sizeof(slist_t));
+}
+
+static void slist_dealloc(slist_t *xs) {
+  free(xs);
+}
+#endif
+
 slist_t *slist_cons(const char *text, slist_t *rest) {
-  slist_t *xs = malloc(sizeof(slist_t));
+  slist_t *xs = slist_alloc();
   xs->data = strdup(text);
   xs->refs = 1;
   xs->next = rest;
@@ -13,7 +39,7 @@ slist_t *slist_cons(const char *text, slist_t *rest) {
 }
 
 slist_t *slist_cons_ptr(void *ptr, slist_t *rest) {
-  slist_t *xs = malloc(sizeof(slist_t));
+  slist_t *xs = slist_alloc();
   xs->data = ptr;
   xs->refs = 1;
   xs->next = rest;
@@ -27,7 +53,7 @@ void slist_free(slist_t *xs) {
   if (xs->refs == 0) {
     slist_free(xs->next);
     free(xs->data);
-    free(xs);
+    slist_dealloc(xs);
   }
 }
 